@@ -0,0 +1,110 @@
+/*
+   BC1 block benchmark
+
+   Times bc1_encode_block on random blocks and round trips a set of
+   blocks through the encoder and decoder, counting the worst channel
+   error of each.  The two primary blocks, red and green, red and blue,
+   green and blue, have colour axes orthogonal to grey, their colours
+   are exact in 565 and have to come back within a step of rounding.
+
+   build: ninja bench_bcn
+*/
+
+#include "../include/image/bcn.hpp"
+
+#include <chrono>
+#include <random>
+
+namespace yam
+{
+   OutputTarget log;
+}
+
+namespace
+{
+   typedef std::chrono::steady_clock bench_clock;
+
+   const uint32_t blocks = 200000;
+
+   struct round_trip_t
+   {
+      const char*    name;
+      uint8_t        a[3], b[3];
+
+      // Largest channel error that still passes
+      int32_t        tolerance;
+   };
+
+   // Checkerboard of a and b, every channel of every pixel compared after decoding
+   int32_t round_trip(const round_trip_t& test)
+   {
+      uint8_t rgba[64], block[8], decoded[64];
+
+      for (int p = 0; p < 16; ++p)
+      {
+         const uint8_t* c = (((p & 3) + (p >> 2)) & 1) ? test.b : test.a;
+
+         rgba[p * 4 + 0] = c[0];
+         rgba[p * 4 + 1] = c[1];
+         rgba[p * 4 + 2] = c[2];
+         rgba[p * 4 + 3] = 255;
+      }
+
+      yam::bc1_encode_block(rgba, block);
+      yam::bc1_decode_block(block, decoded);
+
+      int32_t worst = 0;
+
+      for (int p = 0; p < 16; ++p)
+      {
+         for (int i = 0; i < 3; ++i)
+            worst = std::max(worst, std::abs(rgba[p * 4 + i] - decoded[p * 4 + i]));
+      }
+
+      return worst;
+   }
+}
+
+int main()
+{
+   const round_trip_t tests[] =
+   {
+      { "red and green",      { 255,   0,   0 }, {   0, 255,   0 },  4 },
+      { "red and blue",       { 255,   0,   0 }, {   0,   0, 255 },  4 },
+      { "green and blue",     {   0, 255,   0 }, {   0,   0, 255 },  4 },
+      { "dark red and green", { 128,   0,   0 }, {   0, 128,   0 },  8 },
+      { "black and white",    {   0,   0,   0 }, { 255, 255, 255 },  4 },
+      { "flat grey",          { 128, 128, 128 }, { 128, 128, 128 },  8 },
+   };
+
+   bool ok = true;
+
+   for (const round_trip_t& test : tests)
+   {
+      const int32_t worst = round_trip(test);
+
+      printf("%-20s worst channel error %3d   %s\n", test.name, worst, (worst <= test.tolerance) ? "ok" : "FAIL");
+
+      if (worst > test.tolerance)
+         ok = false;
+   }
+
+   std::mt19937 rng(1);
+   std::vector<uint8_t> source(blocks * 64);
+
+   for (uint8_t& value : source)
+      value = rng();
+
+   std::vector<uint8_t> encoded(blocks * 8);
+
+   auto start = bench_clock::now();
+
+   for (uint32_t i = 0; i < blocks; ++i)
+      yam::bc1_encode_block(&source[i * 64], &encoded[i * 8]);
+
+   const double ms = std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+
+   printf("%u random blocks encoded in %.3f ms, %.1f Mpixels/s\n", blocks, ms, blocks * 16 / ms / 1000.0);
+
+   return ok ? 0 : 1;
+}
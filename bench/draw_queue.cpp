@@ -0,0 +1,381 @@
+/*
+   Draw submission benchmark
+
+   Submits 100k sprites a frame, spread over 256 layers and 4 shaders in
+   random order, and gets them into upload order two ways: the old
+   std::map keyed by layer and shader name with a vertex buffer per key,
+   and the DrawQueue with integer keys and a radix sort, adding vertices
+   one at a time, reserving a quad's 6 vertices at once, and reserving
+   the 4 corners of a DRAW_QUADS quad.  The sprites also go through the
+   SpriteQueue as one instance each, which only gets timed and sized, the
+   vertex shader expands those.  None of them touches GL.  The map
+   side copies its buffers into one staging buffer where the renderer
+   uploaded them one by one, the queue sorts into a plain array where the
+   renderer has the mapped stream buffer.  All of them have to end up with
+   the same vertices in the same order, the quads once they are expanded
+   through the renderer's shared index pattern.  A mix of strips, lines
+   and triangles in the same layers and shaders also has to come out of
+   the queue in the map's order, by descending primitive type, and so
+   does the same mix with quads in place of the triangles.
+
+   build: ninja bench_draw_queue
+*/
+
+#include "../include/draw_queue.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+
+namespace yam
+{
+   OutputTarget log;
+}
+
+namespace
+{
+   typedef std::chrono::steady_clock bench_clock;
+
+   const uint32_t sprites = 100000;
+   const uint32_t layers = 256;
+   const uint32_t frames = 20;
+
+   // In name order, so both sides sort the shaders the same way
+   const char* shader_names[] = { "font", "lit", "sprite", "ui" };
+
+   template<typename F>
+   double time_ms(F func)
+   {
+      auto start = bench_clock::now();
+      func();
+      return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+   }
+
+   uint64_t fnv1a(const uint8_t* data, size_t size)
+   {
+      uint64_t hash = 0xcbf29ce484222325ull;
+
+      for (size_t i = 0; i < size; ++i)
+         hash = (hash ^ data[i]) * 0x100000001b3ull;
+
+      return hash;
+   }
+
+   struct sprite_t
+   {
+      uint32_t layer;
+      uint32_t shader;
+      yam::vertex_t corners[4];
+   };
+
+   // The renderer's draw order key before the queue
+   struct rord_t
+   {
+      uint32_t       z_order;
+      wcl::string    shader;
+      GLenum         array_type;
+
+      bool operator<(const rord_t& value) const
+      {
+         return std::tie(value.z_order, shader, value.array_type)
+              < std::tie(z_order, value.shader, array_type);
+      }
+
+      rord_t(uint32_t z, const wcl::string& mat, GLenum at) : z_order(z), shader(mat), array_type(at) {}
+   };
+
+   struct map_renderer_t
+   {
+      std::map<rord_t, wheel::buffer_t>   buffers;
+      wcl::string                         current_shader;
+      std::vector<uint8_t>                staging;
+      size_t                              draws;
+
+      void AddVertex(const yam::vertex_t& vertex, uint32_t z_order, GLenum array_type = GL_TRIANGLES)
+      {
+         wheel::buffer_t& cbuf = buffers[rord_t(z_order, current_shader, array_type)];
+
+         cbuf.write<float>(vertex.x0);
+         cbuf.write<float>(vertex.y0);
+
+         cbuf.write<uint16_t>(vertex.s0);
+         cbuf.write<uint16_t>(vertex.t0);
+
+         cbuf.write<uint8_t>(vertex.r);
+         cbuf.write<uint8_t>(vertex.g);
+         cbuf.write<uint8_t>(vertex.b);
+         cbuf.write<uint8_t>(vertex.a);
+      }
+
+      void Flush()
+      {
+         staging.clear();
+         draws = 0;
+
+         for (auto& buf : buffers)
+         {
+            if (buf.second.size() != 0)
+            {
+               staging.insert(staging.end(), buf.second.begin(), buf.second.end());
+               draws++;
+            }
+
+            buf.second.clear();
+            buf.second.seek(0);
+         }
+      }
+   };
+
+   std::vector<sprite_t> make_sprites()
+   {
+      std::mt19937 rng(1);
+      std::vector<sprite_t> result(sprites);
+
+      for (sprite_t& sprite : result)
+      {
+         sprite.layer = rng() % layers;
+         sprite.shader = rng() % 4;
+
+         for (yam::vertex_t& corner : sprite.corners)
+         {
+            corner.x0 = (rng() % 2000) / 1000.0f - 1.0f;
+            corner.y0 = (rng() % 2000) / 1000.0f - 1.0f;
+            corner.s0 = rng();
+            corner.t0 = rng();
+            corner.r = corner.g = corner.b = corner.a = rng();
+         }
+      }
+
+      return result;
+   }
+
+   /*
+      Every sprite as triangles, every 4th one outlined with lines and every
+      8th one as a triangle strip as well, through the map and the queue.  With quads the queue gets DRAW_QUADS
+      in place of the triangles, expanded like glDrawElements does.
+   */
+   bool check_mixed(const std::vector<sprite_t>& scene, bool quads, size_t* draws)
+   {
+      map_renderer_t map;
+      yam::DrawQueue queue;
+
+      for (size_t i = 0; i < scene.size(); ++i)
+      {
+         const sprite_t& s = scene[i];
+
+         map.current_shader = shader_names[s.shader];
+
+         for (uint32_t corner : { 0, 1, 3, 1, 2, 3 })
+         {
+            map.AddVertex(s.corners[corner], s.layer, GL_TRIANGLES);
+
+            if (!quads)
+               queue.Add(yam::draw_key(s.layer, s.shader, GL_TRIANGLES), s.corners[corner]);
+         }
+
+         if (quads)
+         {
+            for (uint32_t corner : { 0, 1, 2, 3 })
+               queue.Add(yam::draw_key(s.layer, s.shader, yam::DRAW_QUADS), s.corners[corner]);
+         }
+
+         if (i % 8 == 0)
+         {
+            for (uint32_t corner : { 0, 1, 3, 2 })
+            {
+               map.AddVertex(s.corners[corner], s.layer, GL_TRIANGLE_STRIP);
+               queue.Add(yam::draw_key(s.layer, s.shader, GL_TRIANGLE_STRIP), s.corners[corner]);
+            }
+         }
+
+         if (i % 4 != 0)
+            continue;
+
+         for (uint32_t corner : { 0, 1, 1, 2, 2, 3, 3, 0 })
+         {
+            map.AddVertex(s.corners[corner], s.layer, GL_LINES);
+            queue.Add(yam::draw_key(s.layer, s.shader, GL_LINES), s.corners[corner]);
+         }
+      }
+
+      map.Flush();
+
+      std::vector<yam::vertex_t> sorted(queue.Size());
+      queue.Sort(&sorted[0]);
+
+      if (quads)
+      {
+         std::vector<yam::vertex_t> expanded;
+
+         for (const yam::draw_command_t& batch : queue.Batches())
+         {
+            if (yam::draw_key_primitive(batch.key) != yam::DRAW_QUADS)
+            {
+               expanded.insert(expanded.end(), &sorted[batch.first], &sorted[batch.first] + batch.count);
+               continue;
+            }
+
+            for (uint32_t quad = batch.first; quad < batch.first + batch.count; quad += 4)
+            {
+               for (uint32_t index : { 0, 1, 3, 1, 2, 3 })
+                  expanded.push_back(sorted[quad + index]);
+            }
+         }
+
+         sorted.swap(expanded);
+      }
+
+      *draws = queue.Batches().size();
+
+      return (map.draws == queue.Batches().size())
+          && (map.staging.size() == sorted.size() * sizeof(yam::vertex_t))
+          && (memcmp(&map.staging[0], &sorted[0], map.staging.size()) == 0);
+   }
+}
+
+int main()
+{
+   const std::vector<sprite_t> scene = make_sprites();
+
+   map_renderer_t old_path;
+   yam::DrawQueue queue;
+   std::vector<yam::vertex_t> vertices(sprites * 6);
+   std::vector<yam::vertex_t> reserved(sprites * 6);
+   std::vector<yam::vertex_t> quads(sprites * 4);
+
+   yam::SpriteQueue sprite_queue;
+   std::vector<yam::sprite_instance_t> instances(sprites);
+
+   double t_map = 0, t_queue = 0, t_reserve = 0, t_quads = 0, t_instances = 0;
+
+   for (uint32_t frame = 0; frame < frames; ++frame)
+   {
+      t_map += time_ms([&]()
+      {
+         for (const sprite_t& s : scene)
+         {
+            old_path.current_shader = shader_names[s.shader];
+
+            for (uint32_t corner : { 0, 1, 3, 1, 2, 3 })
+               old_path.AddVertex(s.corners[corner], s.layer);
+         }
+
+         old_path.Flush();
+      });
+
+      queue.Clear();
+
+      t_queue += time_ms([&]()
+      {
+         for (const sprite_t& s : scene)
+         {
+            const uint64_t key = yam::draw_key(s.layer, s.shader, GL_TRIANGLES);
+
+            for (uint32_t corner : { 0, 1, 3, 1, 2, 3 })
+               queue.Add(key, s.corners[corner]);
+         }
+
+         queue.Sort(&vertices[0]);
+      });
+
+      queue.Clear();
+
+      t_reserve += time_ms([&]()
+      {
+         for (const sprite_t& s : scene)
+         {
+            yam::vertex_t* v = queue.Reserve(yam::draw_key(s.layer, s.shader, GL_TRIANGLES), 6);
+
+            v[0] = s.corners[0];
+            v[1] = s.corners[1];
+            v[2] = s.corners[3];
+            v[3] = s.corners[1];
+            v[4] = s.corners[2];
+            v[5] = s.corners[3];
+         }
+
+         queue.Sort(&reserved[0]);
+      });
+
+      queue.Clear();
+
+      t_quads += time_ms([&]()
+      {
+         for (const sprite_t& s : scene)
+         {
+            yam::vertex_t* v = queue.Reserve(yam::draw_key(s.layer, s.shader, yam::DRAW_QUADS), 4);
+
+            v[0] = s.corners[0];
+            v[1] = s.corners[1];
+            v[2] = s.corners[2];
+            v[3] = s.corners[3];
+         }
+
+         queue.Sort(&quads[0]);
+      });
+
+      sprite_queue.Clear();
+
+      t_instances += time_ms([&]()
+      {
+         for (const sprite_t& s : scene)
+         {
+            const uint64_t key = yam::draw_key(s.layer, s.shader, yam::DRAW_SPRITES);
+            yam::sprite_instance_t* instance = sprite_queue.Reserve(key, 1);
+
+            instance->x = s.corners[0].x0;
+            instance->y = s.corners[0].y0;
+            instance->w = 32;
+            instance->h = 32;
+            instance->pivot_x = 16;
+            instance->pivot_y = 16;
+            instance->angle = s.corners[1].x0;
+            instance->s0 = s.corners[0].s0;
+            instance->t0 = s.corners[0].t0;
+            instance->s1 = s.corners[2].s0;
+            instance->t1 = s.corners[2].t0;
+            instance->r = instance->g = instance->b = instance->a = s.corners[0].r;
+         }
+
+         sprite_queue.Sort(&instances[0]);
+      });
+   }
+
+   // What glDrawElements reads with the indices from Renderer::reserve_quad_indices
+   std::vector<yam::vertex_t> expanded;
+
+   for (uint32_t quad = 0; quad < sprites; ++quad)
+   {
+      for (uint32_t index : { 0, 1, 3, 1, 2, 3 })
+         expanded.push_back(quads[quad * 4 + index]);
+   }
+
+   const bool same = (old_path.staging.size() == vertices.size() * sizeof(yam::vertex_t))
+                  && (fnv1a(&old_path.staging[0], old_path.staging.size())
+                   == fnv1a((const uint8_t*)&vertices[0], vertices.size() * sizeof(yam::vertex_t)))
+                  && (memcmp(&vertices[0], &reserved[0], vertices.size() * sizeof(yam::vertex_t)) == 0)
+                  && (memcmp(&vertices[0], &expanded[0], vertices.size() * sizeof(yam::vertex_t)) == 0);
+
+   size_t mixed_draws, mixed_quad_draws;
+   const bool mixed_same = check_mixed(scene, false, &mixed_draws);
+   const bool mixed_quads_same = check_mixed(scene, true, &mixed_quad_draws);
+
+   printf("%u sprites, %u layers, 4 shaders, average of %u frames\n", sprites, layers, frames);
+   printf("std::map by layer and name  %8.3f ms   %zu draws\n", t_map / frames, old_path.draws);
+   printf("radix sorted draw queue     %8.3f ms   %zu draws   %.1fx faster\n",
+          t_queue / frames, queue.Batches().size(), t_map / t_queue);
+   printf("  reserving whole quads     %8.3f ms   %zu draws   %.1fx faster   %s\n",
+          t_reserve / frames, queue.Batches().size(), t_map / t_reserve, same ? "identical" : "MISMATCH");
+   printf("  indexed quads             %8.3f ms   %zu draws   %.1fx faster   %zu of %zu bytes uploaded\n",
+          t_quads / frames, queue.Batches().size(), t_map / t_quads,
+          quads.size() * sizeof(yam::vertex_t), vertices.size() * sizeof(yam::vertex_t));
+   printf("  instanced sprites         %8.3f ms   %zu draws   %.1fx faster   %zu of %zu bytes uploaded\n",
+          t_instances / frames, sprite_queue.Batches().size(), t_map / t_instances,
+          instances.size() * sizeof(yam::sprite_instance_t), vertices.size() * sizeof(yam::vertex_t));
+   printf("strips, lines and triangles             %zu draws   %s\n",
+          mixed_draws, mixed_same ? "identical" : "MISMATCH");
+   printf("strips, lines and quads                 %zu draws   %s\n",
+          mixed_quad_draws, mixed_quads_same ? "identical" : "MISMATCH");
+
+   return (same && mixed_same && mixed_quads_same) ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+/*
+   Decoded image cache warm start benchmark
+
+   Loads an asset set three ways: decoding every PNG like startup does
+   without the cache, through an empty cache (decode and store), and
+   through the filled cache (hash and map).  All three hash the pixels
+   they end up with, standing in for the texture upload, and have to
+   agree on them.
+
+   Uses the PNG files given on the command line, or the ones shipped in
+   the repository plus a large synthetic image.
+
+   build: ninja bench_image_cache
+*/
+
+#include "../include/image_cache.h"
+#include "../include/image/png.hpp"
+
+#include <chrono>
+#include <dirent.h>
+#include <random>
+
+namespace yam
+{
+   OutputTarget log;
+}
+
+namespace
+{
+   typedef std::chrono::steady_clock bench_clock;
+
+   const char* cache_dir = "bench_image_cache";
+   const char* synthetic_file = "bench_image_cache.png";
+
+   template<typename F>
+   double time_ms(F func)
+   {
+      auto start = bench_clock::now();
+      func();
+      return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+   }
+
+   void clear_cache()
+   {
+      DIR* dir = opendir(cache_dir);
+
+      if (dir == nullptr)
+         return;
+
+      while (dirent* entry = readdir(dir))
+      {
+         if (entry->d_name[0] != '.')
+            remove((std::string(cache_dir) + "/" + entry->d_name).c_str());
+      }
+
+      closedir(dir);
+   }
+
+   uint64_t load_uncached(const std::vector<const char*>& files)
+   {
+      uint64_t sum = 0;
+
+      for (const char* file : files)
+      {
+         yam::image_t image;
+
+         if (yam::load_to_buffer<yam::format::PNG>(image, file, yam::IMAGE_BOTTOM_UP) == WHEEL_OK)
+            sum += yam::hash_bytes(&image.image[0], image.image.size());
+      }
+
+      return sum;
+   }
+
+   uint64_t load_cached(yam::ImageCache& cache, const std::vector<const char*>& files, uint32_t* hits)
+   {
+      uint64_t sum = 0;
+      *hits = 0;
+
+      for (const char* file : files)
+      {
+         yam::cached_image_t image;
+
+         if (cache.Fetch(file, image) == WHEEL_OK)
+         {
+            sum += yam::hash_bytes(image.pixels, (size_t)image.width * image.height * image.channels);
+            *hits += image.hit;
+         }
+      }
+
+      return sum;
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   yam::log.set_priority(yam::ERROR);
+
+   std::vector<const char*> files;
+
+   for (int i = 1; i < argc; ++i)
+      files.push_back(argv[i]);
+
+   if (files.empty())
+   {
+      files = { "bitmapfont.png", "content/test_diffuse.png", "content/test_paletted.png", synthetic_file };
+
+      yam::image_t image;
+      image.width = 2048;
+      image.height = 2048;
+      image.channels = 4;
+      image.image.resize((size_t)image.width * image.height * image.channels);
+
+      // Noise over a gradient, so it compresses about as well as real art
+      std::mt19937 rng(1);
+
+      for (size_t i = 0; i < image.image.size(); ++i)
+         image.image[i] = (i / 4096 + i % 4096 / 16 + (rng() & 15)) & 0xff;
+
+      yam::save_png(synthetic_file, image);
+   }
+
+   yam::ImageCache cache(cache_dir);
+   uint32_t hits;
+
+   clear_cache();
+
+   uint64_t sum_uncached = 0, sum_cold = 0, sum_warm = 0;
+
+   double t_uncached = time_ms([&]() { sum_uncached = load_uncached(files); });
+   double t_cold = time_ms([&]() { sum_cold = load_cached(cache, files, &hits); });
+   double t_warm = time_ms([&]() { sum_warm = load_cached(cache, files, &hits); });
+
+   bool same = (sum_uncached == sum_cold) && (sum_cold == sum_warm);
+
+   printf("%zu images\n", files.size());
+   printf("decode, no cache   %9.3f ms\n", t_uncached);
+   printf("cold cache         %9.3f ms\n", t_cold);
+   printf("warm cache         %9.3f ms   %u/%zu hits   %.1fx faster than decoding   %s\n",
+          t_warm, hits, files.size(), t_uncached / t_warm, same ? "identical" : "MISMATCH");
+
+   clear_cache();
+   remove(cache_dir);
+
+   if (argc < 2)
+      remove(synthetic_file);
+
+   return (same && (hits == files.size())) ? 0 : 1;
+}
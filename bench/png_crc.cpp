@@ -0,0 +1,129 @@
+/*
+   PNG chunk CRC benchmark
+
+   Compares the byte-at-a-time wcl::update_crc against the slice-by-8
+   update_crc32 in include/crc32.hpp, and times read_png with and without
+   IMAGE_TRUSTED on the PNG files given on the command line (or the ones
+   shipped in the repository) and on a large synthetic image.
+
+   build: ninja bench_png_crc
+*/
+
+#include "../include/image/png.hpp"
+
+#include <chrono>
+#include <random>
+
+namespace yam
+{
+   OutputTarget log;
+}
+
+namespace
+{
+   typedef std::chrono::steady_clock bench_clock;
+
+   template<typename F>
+   double time_ms(F func, uint32_t rounds)
+   {
+      auto start = bench_clock::now();
+
+      for (uint32_t i = 0; i < rounds; ++i)
+         func();
+
+      return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count() / rounds;
+   }
+
+   bool compare_crc(size_t size, uint32_t rounds)
+   {
+      wcl::buffer_t data;
+      data.resize(size);
+
+      std::mt19937 rng(size);
+
+      for (size_t i = 0; i < size; ++i)
+         data[i] = rng();
+
+      uint32_t crc_old = 0, crc_new = 0;
+
+      double t_old = time_ms([&]() { crc_old = wcl::update_crc(0xffffffff, &data[0], size); }, rounds);
+      double t_new = time_ms([&]() { crc_new = yam::update_crc32(0xffffffff, &data[0], size); }, rounds);
+
+      double mb = size / (1024.0 * 1024.0);
+
+      printf("crc32 %9zu bytes   old %8.1f MB/s   new %8.1f MB/s   %5.1fx   %s\n",
+             size, mb / (t_old / 1000.0), mb / (t_new / 1000.0), t_old / t_new,
+             (crc_old == crc_new) ? "identical" : "MISMATCH");
+
+      return crc_old == crc_new;
+   }
+
+   bool compare_read(const char* name, const wcl::buffer_t& png, uint32_t rounds)
+   {
+      uint32_t w, h, c;
+      wcl::buffer_t checked, trusted;
+
+      double t_checked = time_ms([&]() { yam::read_png(png, &w, &h, &c, &checked); }, rounds);
+      double t_trusted = time_ms([&]() { yam::read_png(png, &w, &h, &c, &trusted, nullptr, yam::IMAGE_TRUSTED); }, rounds);
+
+      bool same = (checked == trusted);
+
+      printf("%-32s %5ux%-5u  checked %8.3f ms   trusted %8.3f ms   CRC share %4.1f%%   %s\n",
+             name, w, h, t_checked, t_trusted, 100.0 * (t_checked - t_trusted) / t_checked,
+             same ? "identical" : "MISMATCH");
+
+      return same;
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   yam::log.set_priority(yam::WARNING);
+
+   bool ok = true;
+
+   ok &= compare_crc(4096, 20000);
+   ok &= compare_crc(1 << 20, 100);
+   ok &= compare_crc(64 << 20, 2);
+
+   std::vector<const char*> files;
+
+   for (int i = 1; i < argc; ++i)
+      files.push_back(argv[i]);
+
+   if (files.empty())
+      files = { "bitmapfont.png", "content/test_diffuse.png", "content/test_paletted.png" };
+
+   for (const char* file : files)
+   {
+      wcl::buffer_t* png = wcl::GetBuffer(file);
+      if (png == nullptr)
+      {
+         printf("%s: can't open\n", file);
+         continue;
+      }
+
+      ok &= compare_read(file, *png, 20);
+
+      wcl::DeleteBuffer(file);
+   }
+
+   // Stored without compression, so the CRC has as much to do as it ever will
+   yam::image_t image;
+   image.width = 2048;
+   image.height = 2048;
+   image.channels = 4;
+   image.image.resize((size_t)image.width * image.height * image.channels);
+
+   std::mt19937 rng(1);
+
+   for (size_t i = 0; i < image.image.size(); ++i)
+      image.image[i] = rng();
+
+   wcl::buffer_t png;
+   yam::encode_png(image, png, yam::PNG_LEVEL_STORE);
+
+   ok &= compare_read("synthetic, stored", png, 5);
+
+   return ok ? 0 : 1;
+}
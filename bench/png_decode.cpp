@@ -0,0 +1,242 @@
+/*
+   PNG unfilter benchmark
+
+   Compares the old byte-at-a-time reconstruction loop of read_png against
+   the row kernels in include/image/png_filter.hpp, on the PNG files given
+   on the command line (or the ones shipped in the repository) and on large
+   synthetic images.  Both paths have to produce identical output.
+
+   build: ninja bench_png_decode
+*/
+
+#include "../include/image/png.hpp"
+
+#include <chrono>
+#include <random>
+
+namespace yam
+{
+   OutputTarget log;
+}
+
+namespace
+{
+   typedef std::chrono::steady_clock bench_clock;
+
+   // The reconstruction loop read_png used before the row kernels
+   void legacy_unfilter(wcl::buffer_t& image_data, uint32_t w, uint32_t h, uint32_t c,
+                        wcl::buffer_t* target)
+   {
+      uint8_t scanline_filter, pd;
+      size_t col;
+      int32_t left, top, d;
+
+      image_data.seek(0);
+      target->clear();
+
+      for (size_t row = 0; row < h; ++row)
+      {
+         scanline_filter = image_data.read<uint8_t>();
+         col = 0;
+
+         while (col < w)
+         {
+            for (size_t ch = 0; ch < c; ++ch)
+            {
+               pd = image_data.read<uint8_t>();
+
+               if (col == 0)
+                  left = 0;
+               else
+                  left = target->at(target->size() - 1 * c);
+
+               if (row == 0)
+                  top = 0;
+               else
+                  top = target->at(target->size() - c * w);
+
+               if (left == 0 && top == 0)
+                  d = 0;
+               else
+               {
+                  if (row == 0)
+                     d = 0;
+                  else if (col == 0)
+                     d = left;
+                  else
+                     d = target->at(target->size() - c * w - c);
+               }
+
+               if (scanline_filter == 0)
+               {
+                  target->push_back(pd);
+               } else if (scanline_filter == 1) {
+                  target->push_back(pd + left);
+               } else if (scanline_filter == 2) {
+                  target->push_back(pd + top);
+               } else if (scanline_filter == 3) {
+                  target->push_back(pd + ((top + left) >> 1));
+               } else if (scanline_filter == 4) {
+                  int32_t p = left + top - d;
+                  int32_t pa = abs(p - left);
+                  int32_t pb = abs(p - top);
+                  int32_t pc = abs(p - d);
+                  uint8_t pr;
+
+                  if ((pa <= pb) && (pa <= pc))
+                     pr = left;
+                  else if (pb <= pc)
+                     pr = top;
+                  else
+                     pr = d;
+
+                  target->push_back(pd + pr);
+               }
+            }
+            col++;
+         }
+      }
+   }
+
+   void row_unfilter(const wcl::buffer_t& image_data, uint32_t w, uint32_t h, uint32_t c,
+                     wcl::buffer_t* target)
+   {
+      const size_t stride = (size_t)w * c;
+
+      target->resize(stride * h);
+
+      wcl::buffer_t zero_row;
+      zero_row.resize(stride);
+
+      const uint8_t* prev = &zero_row[0];
+
+      for (size_t row = 0; row < h; ++row)
+      {
+         const uint8_t* src = &image_data[(stride + 1) * row];
+         uint8_t* dst = &(*target)[stride * row];
+
+         yam::png_unfilter_row(src[0], dst, src + 1, prev, stride, c);
+         prev = dst;
+      }
+   }
+
+   // Inflated IDAT stream of a PNG file
+   bool inflate_png(const wcl::buffer_t& png, wcl::buffer_t& image_data)
+   {
+      wcl::buffer_t idat;
+      size_t pos = 8;
+
+      while (pos + 12 <= png.size())
+      {
+         uint32_t len = (png[pos] << 24) | (png[pos + 1] << 16) | (png[pos + 2] << 8) | png[pos + 3];
+
+         if (pos + 12 + len > png.size())
+            return false;
+
+         if (memcmp(&png[pos + 4], "IDAT", 4) == 0)
+            idat.insert(idat.end(), png.begin() + pos + 8, png.begin() + pos + 8 + len);
+
+         pos += 12 + len;
+      }
+
+      return yam::z_uncompress(&idat[0], idat.size(), image_data) != 0;
+   }
+
+   void synthesize(wcl::buffer_t& image_data, uint32_t w, uint32_t h, uint32_t c, uint32_t seed)
+   {
+      std::mt19937 rng(seed);
+
+      image_data.resize(((size_t)w * c + 1) * h);
+
+      for (size_t i = 0; i < image_data.size(); ++i)
+         image_data[i] = rng();
+
+      for (size_t row = 0; row < h; ++row)
+         image_data[((size_t)w * c + 1) * row] = rng() % 5;
+   }
+
+   template<typename F>
+   double time_ms(F func, uint32_t rounds)
+   {
+      auto start = bench_clock::now();
+
+      for (uint32_t i = 0; i < rounds; ++i)
+         func();
+
+      return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count() / rounds;
+   }
+
+   bool compare(const char* name, wcl::buffer_t& image_data, uint32_t w, uint32_t h, uint32_t c,
+                uint32_t rounds)
+   {
+      wcl::buffer_t old_out, new_out;
+
+      double t_old = time_ms([&]() { legacy_unfilter(image_data, w, h, c, &old_out); }, rounds);
+      double t_new = time_ms([&]() { row_unfilter(image_data, w, h, c, &new_out); }, rounds);
+
+      bool same = (old_out.size() == new_out.size())
+               && (memcmp(&old_out[0], &new_out[0], old_out.size()) == 0);
+
+      printf("%-32s %5ux%-5u %u ch   old %9.3f ms   new %8.3f ms   %6.1fx   %s\n",
+             name, w, h, c, t_old, t_new, t_old / t_new, same ? "identical" : "MISMATCH");
+
+      return same;
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   yam::log.set_priority(yam::WARNING);
+
+   std::vector<const char*> files;
+
+   for (int i = 1; i < argc; ++i)
+      files.push_back(argv[i]);
+
+   if (files.empty())
+      files = { "bitmapfont.png", "content/test_diffuse.png", "content/test_paletted.png" };
+
+   bool ok = true;
+
+   for (const char* file : files)
+   {
+      wcl::buffer_t* png = wcl::GetBuffer(file);
+      if (png == nullptr)
+      {
+         printf("%s: can't open\n", file);
+         continue;
+      }
+
+      uint32_t w, h, c;
+      wcl::buffer_t decoded, image_data;
+
+      double t_read = time_ms([&]() { yam::read_png(*png, &w, &h, &c, &decoded); }, 20);
+
+      if (!inflate_png(*png, image_data))
+      {
+         printf("%s: can't inflate\n", file);
+         wcl::DeleteBuffer(file);
+         continue;
+      }
+
+      ok &= compare(file, image_data, w, h, c, 20);
+      printf("%-32s read_png total %8.3f ms\n", "", t_read);
+
+      wcl::DeleteBuffer(file);
+   }
+
+   const uint32_t sizes[][2] = { { 1024, 1024 }, { 4096, 4096 }, { 333, 2011 } };
+
+   for (auto& size : sizes)
+   {
+      for (uint32_t c = 1; c <= 4; ++c)
+      {
+         wcl::buffer_t image_data;
+         synthesize(image_data, size[0], size[1], c, size[0] * c);
+
+         ok &= compare("synthetic", image_data, size[0], size[1], c, size[0] > 2048 ? 1 : 3);
+      }
+   }
+
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,368 @@
+/*
+   Resource lookup benchmark
+
+   The CPU side of drawing text and sprites, without the vertices: every
+   glyph and sprite looks up its rect in an atlas, and every text() and
+   DrawSprite() call switches the shader and back.  The old path does it
+   the way the renderer did with string keyed maps, building the glyph
+   name from the font prefix and hashing it, the atlas name and the shader
+   names for every draw.  The new path goes through a Registry with
+   handles taken at load time, glyphs cached per font by codepoint.  Both
+   have to find the same rects.  A handle taken before its texture is
+   deleted and created again also has to find the new one, the way
+   Renderer::DeleteTexture leaves the name's slot alone.
+
+   build: ninja bench_registry
+*/
+
+#include "../include/registry.h"
+
+#include <chrono>
+#include <random>
+
+namespace yam
+{
+   OutputTarget log;
+}
+
+namespace
+{
+   typedef std::chrono::steady_clock bench_clock;
+
+   const uint32_t lines = 500;
+   const uint32_t line_length = 80;
+   const uint32_t sprites = 100000;
+   const uint32_t sprite_names = 256;
+   const uint32_t frames = 20;
+
+   const char* font_atlas_name = "__yam_fontbuffer";
+   const char* sprite_atlas_name = "__yam_sprite_atlas";
+
+   template<typename F>
+   double time_ms(F func)
+   {
+      auto start = bench_clock::now();
+      func();
+      return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+   }
+
+   struct shader_t {};
+
+   struct atlas_t
+   {
+      std::unordered_map<wcl::string, wheel::rect_t> stored;
+   };
+
+   // The lookups of the renderer before the registry
+   struct string_renderer_t
+   {
+      std::unordered_map<wcl::string, shader_t>    shaderlist;
+      std::unordered_map<wcl::string, uint32_t>    program_ids;
+      std::vector<wcl::string>                     program_names;
+      std::unordered_map<wcl::string, atlas_t>     atlas;
+
+      wcl::string       current_shader;
+      uint32_t          current_program;
+
+      void SetShader(const wcl::string& name)
+      {
+         if (shaderlist.count(name) != 1)
+            printf("Shader requested before it is loaded\n");
+
+         current_shader = name;
+
+         auto found = program_ids.find(name);
+
+         if (found != program_ids.end())
+         {
+            current_program = found->second;
+         } else {
+            current_program = program_names.size();
+            program_ids[name] = current_program;
+            program_names.push_back(name);
+         }
+      }
+
+      wcl::string GetShader() { return current_shader; }
+
+      uint32_t GetAtlasPos(const wcl::string& atlas_name, const wcl::string& sprite_name, wheel::rect_t* result)
+      {
+         if (atlas.count(atlas_name) == 0)
+            return WHEEL_RESOURCE_UNAVAILABLE;
+
+         if (atlas[atlas_name].stored.count(sprite_name) == 0)
+            return WHEEL_RESOURCE_UNAVAILABLE;
+
+         *result = atlas[atlas_name].stored[sprite_name];
+
+         return WHEEL_OK;
+      }
+   };
+
+   struct handle_atlas_t
+   {
+      yam::Registry<wheel::rect_t> stored;
+   };
+
+   // The same lookups through handles
+   struct handle_renderer_t
+   {
+      yam::Registry<shader_t>          shaders;
+      yam::Registry<handle_atlas_t>    atlases;
+
+      yam::handle_t<shader_t>          current_shader;
+      uint32_t                         current_program;
+
+      void SetShader(yam::handle_t<shader_t> shader)
+      {
+         current_shader = shader;
+         current_program = shader ? shader.index + 1 : 0;
+      }
+
+      uint32_t GetAtlasPos(yam::handle_t<handle_atlas_t> atlas, yam::sprite_handle_t sprite, wheel::rect_t* result)
+      {
+         const handle_atlas_t* found = atlases.Get(atlas);
+
+         if (found == nullptr)
+            return WHEEL_RESOURCE_UNAVAILABLE;
+
+         const wheel::rect_t* stored = found->stored.Get(sprite);
+
+         if (stored == nullptr)
+            return WHEEL_RESOURCE_UNAVAILABLE;
+
+         *result = *stored;
+
+         return WHEEL_OK;
+      }
+   };
+
+   // Font::glyph_sprite()
+   struct font_t
+   {
+      wcl::string                                              prefix;
+      std::unordered_map<char32_t, yam::sprite_handle_t>       glyph_sprites;
+
+      yam::sprite_handle_t glyph_sprite(handle_renderer_t& renderer, yam::handle_t<handle_atlas_t> atlas, char32_t glyph)
+      {
+         auto found = glyph_sprites.find(glyph);
+
+         if (found != glyph_sprites.end())
+            return found->second;
+
+         const yam::sprite_handle_t sprite = renderer.atlases.Get(atlas)->stored.Find(prefix + glyph);
+
+         if (sprite)
+            glyph_sprites[glyph] = sprite;
+
+         return sprite;
+      }
+   };
+
+   struct texture_t
+   {
+      uint32_t id;
+   };
+
+   // A handle kept like Shader::AddBinding keeps one, through DeleteTexture and ForgetTexture
+   bool check_recreate()
+   {
+      yam::Registry<texture_t> textures;
+
+      const yam::handle_t<texture_t> bound = textures.Acquire("atlas");
+
+      textures.Insert("atlas", texture_t{ 1 });
+
+      // DeleteTexture, then CreateTexture under the same name
+      textures.Clear(textures.Find("atlas"));
+
+      const bool deleted = (textures.Get(bound) == nullptr);
+
+      textures.Insert("atlas", texture_t{ 2 });
+
+      const texture_t* found = textures.Get(bound);
+      const bool recreated = (found != nullptr) && (found->id == 2);
+
+      // ForgetTexture gives up the name, the old handle can't reach what reuses the slot
+      textures.Remove(textures.Find("atlas"));
+      textures.Insert("other", texture_t{ 3 });
+
+      return deleted && recreated && (textures.Get(bound) == nullptr);
+   }
+
+   uint32_t checksum(uint32_t sum, const wheel::rect_t& r)
+   {
+      return sum * 31 + r.x * 7 + r.y * 5 + r.w * 3 + r.h;
+   }
+}
+
+int main()
+{
+   std::mt19937 rng(1);
+
+   string_renderer_t old_path;
+   handle_renderer_t new_path;
+
+   const char* shader_list[] = { "builtin_primitive", "builtin_text", "builtin_sprite", "final", "testi" };
+
+   for (const char* name : shader_list)
+   {
+      old_path.shaderlist[name];
+      old_path.SetShader(name);
+      new_path.shaders.Insert(name, shader_t());
+   }
+
+   new_path.atlases.Insert(font_atlas_name, handle_atlas_t());
+   new_path.atlases.Insert(sprite_atlas_name, handle_atlas_t());
+
+   const wcl::string font_prefix = "monospace";
+   std::vector<wcl::string> sprite_list;
+
+   // Printable ASCII in the font atlas, named sprites in the sprite atlas
+   for (char32_t c = 33; c < 127; ++c)
+   {
+      const wheel::rect_t r = { (uint32_t)(rng() % 2048), (uint32_t)(rng() % 2048),
+                                (uint32_t)(rng() % 32), (uint32_t)(rng() % 32) };
+
+      old_path.atlas[font_atlas_name].stored[font_prefix + c] = r;
+      new_path.atlases.Get(font_atlas_name)->stored.Insert(font_prefix + c, wheel::rect_t(r));
+   }
+
+   for (uint32_t i = 0; i < sprite_names; ++i)
+   {
+      const wcl::string name = wcl::string("sprites/unit_") + i;
+      const wheel::rect_t r = { (uint32_t)(rng() % 2048), (uint32_t)(rng() % 2048),
+                                (uint32_t)(rng() % 128), (uint32_t)(rng() % 128) };
+
+      sprite_list.push_back(name);
+      old_path.atlas[sprite_atlas_name].stored[name] = r;
+      new_path.atlases.Get(sprite_atlas_name)->stored.Insert(name, wheel::rect_t(r));
+   }
+
+   std::vector<std::vector<char32_t>> text(lines);
+
+   for (std::vector<char32_t>& line : text)
+   {
+      for (uint32_t i = 0; i < line_length; ++i)
+         line.push_back(33 + rng() % 94);
+   }
+
+   std::vector<uint32_t> scene(sprites);
+
+   for (uint32_t& sprite : scene)
+      sprite = rng() % sprite_names;
+
+   // Taken once, like draw::text() and Game::SpriteHandle() do
+   const yam::handle_t<shader_t> text_shader = new_path.shaders.Acquire("builtin_text");
+   const yam::handle_t<shader_t> sprite_shader = new_path.shaders.Acquire("builtin_sprite");
+   const yam::handle_t<handle_atlas_t> font_atlas = new_path.atlases.Acquire(font_atlas_name);
+   const yam::handle_t<handle_atlas_t> sprite_atlas = new_path.atlases.Acquire(sprite_atlas_name);
+
+   std::vector<yam::sprite_handle_t> sprite_handles;
+
+   for (const wcl::string& name : sprite_list)
+      sprite_handles.push_back(new_path.atlases.Get(sprite_atlas)->stored.Find(name));
+
+   font_t font;
+   font.prefix = font_prefix;
+
+   double t_old_text = 0, t_new_text = 0, t_old_sprites = 0, t_new_sprites = 0;
+   uint32_t old_text_sum = 0, new_text_sum = 0, old_sprite_sum = 0, new_sprite_sum = 0;
+
+   for (uint32_t frame = 0; frame < frames; ++frame)
+   {
+      t_old_text += time_ms([&]()
+      {
+         for (const std::vector<char32_t>& line : text)
+         {
+            wcl::string old_shader = old_path.GetShader();
+
+            old_path.SetShader("builtin_text");
+
+            wheel::rect_t r;
+
+            for (char32_t c : line)
+            {
+               if (old_path.GetAtlasPos(font_atlas_name, font_prefix + c, &r) == WHEEL_OK)
+                  old_text_sum = checksum(old_text_sum, r);
+            }
+
+            if (old_shader != old_path.GetShader())
+               old_path.SetShader(old_shader);
+         }
+      });
+
+      t_new_text += time_ms([&]()
+      {
+         for (const std::vector<char32_t>& line : text)
+         {
+            const yam::handle_t<shader_t> old_shader = new_path.current_shader;
+
+            new_path.SetShader(text_shader);
+
+            wheel::rect_t r;
+
+            for (char32_t c : line)
+            {
+               if (new_path.GetAtlasPos(font_atlas, font.glyph_sprite(new_path, font_atlas, c), &r) == WHEEL_OK)
+                  new_text_sum = checksum(new_text_sum, r);
+            }
+
+            if (old_shader != new_path.current_shader)
+               new_path.SetShader(old_shader);
+         }
+      });
+
+      t_old_sprites += time_ms([&]()
+      {
+         for (uint32_t sprite : scene)
+         {
+            wheel::rect_t r;
+
+            if (old_path.GetAtlasPos(sprite_atlas_name, sprite_list[sprite], &r) != WHEEL_OK)
+               continue;
+
+            wcl::string old_shader = old_path.GetShader();
+
+            old_path.SetShader("builtin_sprite");
+            old_sprite_sum = checksum(old_sprite_sum, r);
+
+            if (old_shader != old_path.GetShader())
+               old_path.SetShader(old_shader);
+         }
+      });
+
+      t_new_sprites += time_ms([&]()
+      {
+         for (uint32_t sprite : scene)
+         {
+            wheel::rect_t r;
+
+            if (new_path.GetAtlasPos(sprite_atlas, sprite_handles[sprite], &r) != WHEEL_OK)
+               continue;
+
+            const yam::handle_t<shader_t> old_shader = new_path.current_shader;
+
+            new_path.SetShader(sprite_shader);
+            new_sprite_sum = checksum(new_sprite_sum, r);
+
+            if (old_shader != new_path.current_shader)
+               new_path.SetShader(old_shader);
+         }
+      });
+   }
+
+   const bool same = (old_text_sum == new_text_sum) && (old_sprite_sum == new_sprite_sum);
+   const bool recreate = check_recreate();
+
+   printf("%u glyphs in %u lines, %u sprites of %u, average of %u frames\n",
+          lines * line_length, lines, sprites, sprite_names, frames);
+   printf("text     string keys  %8.3f ms   handles  %8.3f ms   %.1fx faster\n",
+          t_old_text / frames, t_new_text / frames, t_old_text / t_new_text);
+   printf("sprites  string keys  %8.3f ms   handles  %8.3f ms   %.1fx faster\n",
+          t_old_sprites / frames, t_new_sprites / frames, t_old_sprites / t_new_sprites);
+   printf("%s\n", same ? "identical" : "MISMATCH");
+   printf("handle kept through delete and recreate: %s\n", recreate ? "ok" : "FAIL");
+
+   return (same && recreate) ? 0 : 1;
+}
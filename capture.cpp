@@ -0,0 +1,166 @@
+#include "include/capture.h"
+#include "include/renderer.h"
+#include "include/image/png.hpp"
+
+#include <memory>
+
+namespace yam
+{
+   FrameCapture frame_capture;
+
+   uint32_t FrameCapture::Start(const wcl::string& file, const capture_callback_t& done)
+   {
+      // A full ring has to give up its oldest readback before it can take another
+      if (in_flight == ring.size())
+      {
+         log(FULL_DEBUG, "Capture ring full, waiting for the oldest frame\n");
+
+         uint32_t result = Retire(ring[oldest]);
+
+         oldest = (oldest + 1) % ring.size();
+         in_flight--;
+
+         if (result != WHEEL_OK)
+            return result;
+      }
+
+      slot_t& slot = ring[(oldest + in_flight) % ring.size()];
+
+      slot.width = renderer.GetTargetWidth();
+      slot.height = renderer.GetTargetHeight();
+      slot.sequence = sequence++;
+      slot.file = file;
+      slot.done = done;
+
+      if (slot.buffer == 0)
+         glGenBuffers(1, &slot.buffer);
+
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+      glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)slot.width * slot.height * 4, nullptr, GL_STREAM_READ);
+
+      // With a pack buffer bound this only queues the copy
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+      glReadPixels(0, 0, slot.width, slot.height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+      slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      in_flight++;
+
+      return WHEEL_OK;
+   }
+
+   uint32_t FrameCapture::Capture(const wcl::string& file)
+   {
+      return Start(file, capture_callback_t());
+   }
+
+   uint32_t FrameCapture::Capture(const capture_callback_t& done)
+   {
+      return Start("", done);
+   }
+
+   // Waits for the readback of slot, copies it out and queues the encode
+   uint32_t FrameCapture::Retire(slot_t& slot)
+   {
+      GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, ~(GLuint64)0);
+
+      glDeleteSync(slot.fence);
+      slot.fence = 0;
+
+      if (status == GL_WAIT_FAILED)
+      {
+         log(ERROR, "Waiting for frame capture ", slot.sequence, " failed\n");
+         return WHEEL_ERROR;
+      }
+
+      const size_t stride = (size_t)slot.width * 4;
+
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+      const uint8_t* pixels = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, stride * slot.height,
+                                                               GL_MAP_READ_BIT);
+
+      if (pixels == nullptr)
+      {
+         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+         log(ERROR, "Can't map frame capture ", slot.sequence, "\n");
+         return WHEEL_ERROR;
+      }
+
+      image_t image;
+      image.width = slot.width;
+      image.height = slot.height;
+      image.channels = 4;
+      image.image.resize(stride * slot.height);
+
+      // GL gives the bottom row first, flipped while copying out of the mapping
+      for (uint32_t y = 0; y < slot.height; ++y)
+         memcpy(&image.image[stride * y], pixels + stride * (slot.height - 1 - y), stride);
+
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+      const uint64_t id = slot.sequence;
+      const wcl::string file = slot.file;
+      const capture_callback_t done = slot.done;
+
+      slot.file = "";
+      slot.done = capture_callback_t();
+
+      // The image is moved into the job through a shared pointer, std::function needs copyable state
+      std::shared_ptr<image_t> frame = std::make_shared<image_t>(std::move(image));
+
+      encoder.Submit([id, file, done, frame]()
+      {
+         if (done)
+            done(id, *frame);
+         else
+            save_png(file, *frame, PNG_LEVEL_FASTEST, 1);
+      });
+
+      return WHEEL_OK;
+   }
+
+   uint32_t FrameCapture::Collect(bool wait)
+   {
+      uint32_t collected = 0;
+
+      // In order, so the encoder sees the frames in the order they were captured
+      while (in_flight > 0)
+      {
+         slot_t& slot = ring[oldest];
+
+         if (!wait)
+         {
+            GLenum status = glClientWaitSync(slot.fence, 0, 0);
+
+            if ((status != GL_ALREADY_SIGNALED) && (status != GL_CONDITION_SATISFIED)
+            && (status != GL_WAIT_FAILED))
+               break;
+         }
+
+         Retire(slot);
+
+         oldest = (oldest + 1) % ring.size();
+         in_flight--;
+         collected++;
+      }
+
+      return collected;
+   }
+
+   void FrameCapture::Finish()
+   {
+      Collect(true);
+      encoder.Wait();
+
+      for (slot_t& slot : ring)
+      {
+         if (slot.buffer != 0)
+            glDeleteBuffers(1, &slot.buffer);
+
+         slot.buffer = 0;
+      }
+
+      oldest = 0;
+   }
+}
@@ -0,0 +1,53 @@
+#include "include/draw_queue.h"
+
+namespace yam
+{
+   void radix_sort(std::vector<draw_command_t>& commands, std::vector<draw_command_t>& scratch)
+   {
+      const size_t count = commands.size();
+
+      if (count < 2)
+         return;
+
+      // Histograms of all eight bytes in one pass
+      uint32_t histogram[8][256] = {};
+
+      for (const draw_command_t& command : commands)
+      {
+         for (uint32_t digit = 0; digit < 8; ++digit)
+            histogram[digit][(command.key >> (digit * 8)) & 0xff]++;
+      }
+
+      scratch.resize(count);
+
+      draw_command_t* src = &commands[0];
+      draw_command_t* dst = &scratch[0];
+
+      for (uint32_t digit = 0; digit < 8; ++digit)
+      {
+         uint32_t* counts = histogram[digit];
+         const uint32_t shift = digit * 8;
+
+         // Most bytes are the same in every key, like the high bytes of the layer
+         if (counts[(src[0].key >> shift) & 0xff] == count)
+            continue;
+
+         uint32_t offset = 0;
+
+         for (uint32_t i = 0; i < 256; ++i)
+         {
+            const uint32_t n = counts[i];
+            counts[i] = offset;
+            offset += n;
+         }
+
+         for (size_t i = 0; i < count; ++i)
+            dst[counts[(src[i].key >> shift) & 0xff]++] = src[i];
+
+         std::swap(src, dst);
+      }
+
+      if (src != &commands[0])
+         commands.swap(scratch);
+   }
+}
@@ -21,6 +21,23 @@ namespace yam
       }
    }
 
+   sprite_handle_t Font::glyph_sprite(char32_t glyph)
+   {
+      auto found = glyph_sprites.find(glyph);
+
+      if (found != glyph_sprites.end())
+         return found->second;
+
+      const sprite_handle_t sprite = renderer.SpriteHandle(renderer.AtlasHandle(YAM_FONTBUFFER_NAME),
+                                                           prefix + glyph);
+
+      // Missing glyphs get looked up again once atlas_glyph() added them
+      if (sprite)
+         glyph_sprites[glyph] = sprite;
+
+      return sprite;
+   }
+
    std::tuple<uint32_t, uint32_t, uint32_t, uint32_t, bool, uint32_t>
    BitmapFont::get_next_glyph(image_t& img, uint32_t start, uint32_t row, uint32_t size)
    {
@@ -1,7 +1,10 @@
+#include "include/capture.h"
 #include "include/defaultshaders.h"
 #include "include/game.h"
 #include "include/image.h"
 #include "include/image/png.hpp"
+#include "include/loader.h"
+#include "include/pixelops.h"
 
 #include "include/argparser.hpp"
 
@@ -23,6 +26,8 @@ namespace yam
    Game::Game(uint32_t scrw, uint32_t scrh)
    {
       t_active = false;
+      sprite_atlas = atlas_handle_t();
+      sprite_shader = renderer.ShaderHandle("builtin_sprite");
       int_flags = YAM_CLEAR_FLAGS;
 
       if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER | SDL_INIT_JOYSTICK | SDL_INIT_HAPTIC))
@@ -92,6 +97,8 @@ namespace yam
                   yam::log(WARNING, "Window size changed\n");
                   continue;
                case SDL_WINDOWEVENT_CLOSE:
+                  // Captures still in flight need the context to finish
+                  frame_capture.Finish();
                   renderer.Destroy();
                   continue;
             }
@@ -173,6 +180,89 @@ namespace yam
       return WHEEL_OK;
    }
 
+   uint32_t Game::get_txc(sprite_handle_t sprite, wheel::rect_t& result)
+   {
+      if (!sprite_atlas)
+         return WHEEL_RESOURCE_UNAVAILABLE;
+
+      return renderer.GetAtlasPos(sprite_atlas, sprite, &result);
+   }
+
+   sprite_handle_t Game::SpriteHandle(const wcl::string& sprite)
+   {
+      if (!sprite_atlas)
+         return sprite_handle_t();
+
+      return renderer.SpriteHandle(sprite_atlas, sprite);
+   }
+
+   uint32_t Game::atlas_buffer(const wcl::string& bname, uint32_t w, uint32_t h, void* data)
+   {
+      if (!sprite_atlas)
+      {
+         renderer.CreateAtlas(YAM_SPRITEATLAS_NAME, YAM_SPRITEATLAS_SIZE, 4);
+         sprite_atlas = renderer.AtlasHandle(YAM_SPRITEATLAS_NAME);
+      }
+
+      return renderer.AtlasBuffer(YAM_SPRITEATLAS_NAME, bname, w, h, data);
+   }
+
+   uint32_t Game::DrawSprite(const wcl::string& sprite,
+                             uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                             int32_t pivot_x, int32_t pivot_y, float angle,
+                             uint32_t layer)
+   {
+      const sprite_handle_t handle = SpriteHandle(sprite);
+
+      if (!handle)
+      {
+         log(WARNING, "Can't draw sprite '", sprite, "', it's not in the sprite atlas\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      return DrawSprite(handle, x, y, w, h, pivot_x, pivot_y, angle, layer);
+   }
+
+   uint32_t Game::DrawSprite(sprite_handle_t sprite,
+                             uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                             int32_t pivot_x, int32_t pivot_y, float angle,
+                             uint32_t layer)
+   {
+      wheel::rect_t r;
+
+      if (get_txc(sprite, r) != WHEEL_OK)
+      {
+         log(WARNING, "Can't draw a sprite that's not in the sprite atlas\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      const shader_handle_t old_shader = renderer.CurrentShader();
+
+      renderer.SetShader(sprite_shader);
+
+      sprite_instance_t* instance = renderer.ReserveSprites(1, layer);
+
+      instance->x = (float)x + pivot_x;
+      instance->y = (float)y + pivot_y;
+      instance->w = (w == ~0u) ? r.w : w;
+      instance->h = (h == ~0u) ? r.h : h;
+      instance->pivot_x = pivot_x;
+      instance->pivot_y = pivot_y;
+      instance->angle = angle;
+
+      instance->s0 = ((float)r.x / YAM_SPRITEATLAS_SIZE) * 0xffff;
+      instance->t0 = ((float)r.y / YAM_SPRITEATLAS_SIZE) * 0xffff;
+      instance->s1 = ((float)(r.x + r.w) / YAM_SPRITEATLAS_SIZE) * 0xffff;
+      instance->t1 = ((float)(r.y + r.h) / YAM_SPRITEATLAS_SIZE) * 0xffff;
+
+      instance->r = instance->g = instance->b = instance->a = 0xff;
+
+      if (old_shader != renderer.CurrentShader())
+         renderer.SetShader(old_shader);
+
+      return WHEEL_OK;
+   }
+
    bool Game::Run()
    {
       if (!t_active)
@@ -210,7 +300,13 @@ namespace yam
             t_delay -= update_interval;
          }
 
+         // Textures decoded in the background since the last frame
+         image_loader.Upload();
+
          Render();
+
+         // Readbacks from earlier frames that the GPU has finished by now
+         frame_capture.Collect();
       }
 
       return true;
@@ -224,11 +320,16 @@ void yam::Game::Update()
 
 void yam::Game::Render()
 {
+   static const yam::target_handle_t test_target = renderer.TargetHandle("test_target");
+   static const yam::shader_handle_t primitive = renderer.ShaderHandle("builtin_primitive");
+   static const yam::shader_handle_t testi = renderer.ShaderHandle("testi");
+   static const yam::shader_handle_t final_pass = renderer.ShaderHandle("final");
+
    {
-      yam::renderer.SetTarget("test_target");
+      yam::renderer.SetTarget(test_target);
       renderer.Clear(0x000000ff);
 
-      renderer.SetShader("builtin_primitive");
+      renderer.SetShader(primitive);
 
       draw::rectangle(4, 20, 20, 40, 40, 0xff0f30ef);
       draw::rectangle(3, 40, 40, 40, 40, 0xff0f30ef);
@@ -241,7 +342,7 @@ void yam::Game::Render()
       renderer.SetShader("testi");
       draw::rectangle(3, 40, 40, 240, 240, 0xffffffff);
 */
-      renderer.SetShader("testi");
+      renderer.SetShader(testi);
       draw::rectangle(3, 40, 40, 20, 30, 0xffffffff);
 
       draw::set_cursor(10, 100);
@@ -255,7 +356,7 @@ void yam::Game::Render()
 
       yam::renderer.SetTarget(0);
       renderer.Clear(0.0, 0.0, 0.0);
-      yam::renderer.SetShader("final");
+      yam::renderer.SetShader(final_pass);
       draw::rectangle(0, 0, 0, renderer.scrw, renderer.scrh, 0xffffffff);
 
       yam::renderer.Flush();
@@ -267,14 +368,7 @@ void yam::Game::Render()
 void fill_template(yam::image_t& sprite_template)
 {
    //#799d3d
-   for (size_t i = 0; i < sprite_template.width; ++i)
-   for (size_t j = 0; j < sprite_template.height; ++j)
-   {
-      if (sprite_template[{i,j}].value() == 0x799d3dff)
-      {
-         sprite_template[{i, j}] = 0x303030ff;
-      }
-   }
+   yam::replace_colour(sprite_template, 0x799d3dff, 0x303030ff);
 }
 
 int main(int argc, char* argv[])
@@ -296,6 +390,9 @@ int main(int argc, char* argv[])
    yam::renderer.AddShader("builtin_text", yam::Shader("shaders/gui.vs", "shaders/gui.fs"));
    yam::renderer.shader["builtin_text"].AddBinding(YAM_FONTBUFFER_NAME, "guiatlas");
 
+   yam::renderer.AddShader("builtin_sprite", yam::Shader("shaders/sprite.vs", "shaders/sprite.fs"));
+   yam::renderer.shader["builtin_sprite"].AddBinding(YAM_SPRITEATLAS_NAME, "sprite_atlas");
+
    yam::renderer.AddShader("testi", yam::Shader("shaders/test.vs", "shaders/test.fs"));
    yam::renderer.shader["testi"].AddBinding("test texture", "texture");
 
@@ -328,8 +425,7 @@ int main(int argc, char* argv[])
    yam::image_t img;
 
 //   yam::load_to_buffer<yam::format::PNG>(img, "content/test_paletted.png");
-   yam::load_to_buffer<yam::format::PNG>(img, "template1.png");
-   yam::flip_vertical(img);
+   yam::load_to_buffer<yam::format::PNG>(img, "template1.png", yam::IMAGE_BOTTOM_UP);
 
    fill_template(img);
 
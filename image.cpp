@@ -4,21 +4,16 @@ namespace yam
 {
    void flip_vertical(image_t& img)
    {
-      wcl::buffer_t mod;
-      mod.resize(img.image.size());
+      const size_t stride = (size_t)img.width * img.channels;
 
-      size_t it = 0;
+      if ((img.height < 2) || (stride == 0))
+         return;
 
-      for (int j = 0; j < img.height; ++j)
-      for (int i = 0; i < img.width; ++i)
-      for (int c = 0; c < img.channels; ++c)
-      {
-         mod[img.width * img.channels * (img.height - j - 1) + img.channels * i + c]
-         = img.image[img.width * img.channels * j + img.channels * i + c];
-         it++;
-      }
+      uint8_t* top = &img.image[0];
+      uint8_t* bottom = top + stride * (img.height - 1);
 
-      std::swap(img.image, mod);
+      for (; top < bottom; top += stride, bottom -= stride)
+         std::swap_ranges(top, top + stride, bottom);
    }
 
    void framebuffer_to_image(size_t scrw, size_t scry, image_t& img)
@@ -0,0 +1,256 @@
+#include "include/image_cache.h"
+#include "include/image/png.hpp"
+#include "include/pixelops.h"
+
+#include <sys/stat.h>
+
+namespace yam
+{
+   static constexpr uint32_t image_cache_version = 2;
+
+   static inline uint64_t rotl64(uint64_t x, int r)
+   {
+      return (x << r) | (x >> (64 - r));
+   }
+
+   static inline uint64_t mix64(uint64_t h)
+   {
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ULL;
+      h ^= h >> 33;
+
+      return h;
+   }
+
+   // One lane of MurmurHash3 widened to 64 bit words, with its finaliser
+   uint64_t hash_bytes(const uint8_t* data, size_t len, uint64_t seed)
+   {
+      const uint64_t c1 = 0x87c37b91114253d5ULL;
+      const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+      uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15ULL);
+      size_t i = 0;
+
+      for (; i + 8 <= len; i += 8)
+      {
+         uint64_t k;
+         memcpy(&k, data + i, 8);
+
+         k *= c1;
+         k = rotl64(k, 31);
+         k *= c2;
+
+         h ^= k;
+         h = rotl64(h, 27) * 5 + 0x52dce729;
+      }
+
+      uint64_t tail = 0;
+
+      for (size_t shift = 0; i < len; ++i, shift += 8)
+         tail |= (uint64_t)data[i] << shift;
+
+      h ^= rotl64(tail * c1, 31) * c2;
+
+      return mix64(h);
+   }
+
+   // Bytes in levels mip levels of an image, the first one full size
+   static size_t mip_chain_size(uint32_t w, uint32_t h, uint32_t channels, uint32_t levels)
+   {
+      size_t size = 0;
+
+      for (uint32_t level = 0; level < levels; ++level)
+         size += (size_t)std::max(1u, w >> level) * std::max(1u, h >> level) * channels;
+
+      return size;
+   }
+
+   ImageCache::ImageCache(const wcl::string& directory) : directory(directory)
+   {
+   }
+
+   wcl::string ImageCache::CachePath(uint64_t key) const
+   {
+      char name[32];
+      snprintf(name, sizeof(name), "/%016llx.img", (unsigned long long)key);
+
+      return directory + name;
+   }
+
+   // Written to a temporary file first, so a crash never leaves a half written entry behind
+   uint32_t ImageCache::Store(const wcl::string& path, const image_cache_header_t& header,
+                              const image_t& image) const
+   {
+      mkdir(directory.std_str().c_str(), 0755);
+
+      std::string final_path = path.std_str();
+      std::string temp_path = final_path + ".tmp";
+
+      FILE* file = fopen(temp_path.c_str(), "wb");
+
+      if (file == nullptr)
+         return WHEEL_RESOURCE_UNAVAILABLE;
+
+      bool ok = (fwrite(&header, sizeof(header), 1, file) == 1)
+             && (fwrite(&image.image[0], 1, image.image.size(), file) == image.image.size());
+
+      ok &= (fclose(file) == 0);
+
+      if (!ok || (rename(temp_path.c_str(), final_path.c_str()) != 0))
+      {
+         remove(temp_path.c_str());
+         return WHEEL_ERROR;
+      }
+
+      return WHEEL_OK;
+   }
+
+   uint32_t ImageCache::Fetch(const wcl::string& file, cached_image_t& result, uint32_t flags)
+   {
+      result.hit = false;
+      result.pixels = nullptr;
+      result.mapping.Close();
+
+      wcl::buffer_t* source = wcl::GetBuffer(file);
+
+      if ((source == nullptr) || source->empty())
+      {
+         log(ERROR, "Can't open image ", file, "\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      // The flags that change the pixel layout are part of the key, trusted and checked loads share entries
+      const uint32_t layout = flags & IMAGE_LAYOUT_FLAGS;
+      const uint64_t source_size = source->size();
+      const uint64_t key = hash_bytes(&(*source)[0], source_size, layout);
+      const wcl::string path = CachePath(key);
+
+      image_cache_header_t header;
+
+      if (result.mapping.Open(path) == WHEEL_OK)
+      {
+         bool valid = (result.mapping.Size() >= sizeof(header));
+
+         if (valid)
+         {
+            memcpy(&header, result.mapping.Data(), sizeof(header));
+
+            valid = (memcmp(header.magic, "YIMG", 4) == 0)
+                 && (header.version == image_cache_version)
+                 && (header.source_hash == key)
+                 && (header.source_size == source_size)
+                 && (header.flags == layout)
+                 && (result.mapping.Size() - sizeof(header)
+                     == mip_chain_size(header.width, header.height, header.channels, header.levels));
+         }
+
+         if (valid)
+         {
+            wcl::DeleteBuffer(file);
+
+            result.width = header.width;
+            result.height = header.height;
+            result.channels = header.channels;
+            result.levels = header.levels;
+            result.pixels = result.mapping.Data() + sizeof(header);
+            result.hit = true;
+
+            return WHEEL_OK;
+         }
+
+         log(WARNING, "Ignored stale image cache entry ", path, " for ", file, "\n");
+         result.mapping.Close();
+      }
+
+      image_t& image = result.decoded;
+
+      uint32_t status = read_png(*source, &image.width, &image.height, &image.channels, &image.image,
+                                 nullptr, flags);
+
+      wcl::DeleteBuffer(file);
+
+      if (status != WHEEL_OK)
+         return status;
+
+      uint32_t levels = 1;
+
+      // The smaller levels go right after the image, so the pixels stay one block
+      if (flags & IMAGE_MIPMAPS)
+      {
+         std::vector<image_t> chain;
+         build_mipmaps(image, chain);
+
+         for (const image_t& level : chain)
+            image.image.insert(image.image.end(), level.image.begin(), level.image.end());
+
+         levels += chain.size();
+      }
+
+      memcpy(header.magic, "YIMG", 4);
+      header.version = image_cache_version;
+      header.source_hash = key;
+      header.source_size = source_size;
+      header.width = image.width;
+      header.height = image.height;
+      header.channels = image.channels;
+      header.flags = layout;
+      header.levels = levels;
+      header.reserved = 0;
+
+      if (Store(path, header, image) != WHEEL_OK)
+         log(WARNING, "Can't write image cache entry ", path, "\n");
+
+      result.width = image.width;
+      result.height = image.height;
+      result.channels = image.channels;
+      result.levels = levels;
+      result.pixels = &image.image[0];
+
+      return WHEEL_OK;
+   }
+
+   uint32_t ImageCache::LoadTexture(const wcl::string& texture, const wcl::string& file, uint32_t flags,
+                                    const texture_params_t& params)
+   {
+      if (params.mipmaps == TEXTURE_MIPMAPS_CPU)
+         flags |= IMAGE_MIPMAPS;
+
+      cached_image_t image;
+
+      uint32_t result = Fetch(file, image, flags);
+
+      if (result != WHEEL_OK)
+         return result;
+
+      const uint32_t packed = packed_pixel_type(params.storage, image.pixels,
+                                                (size_t)image.width * image.height, image.channels);
+
+      if (packed != 0)
+         result = renderer.CreateTexture(texture, image.width, image.height, packed_channels(packed), packed, params);
+      else
+         result = renderer.CreateTexture(texture, image.width, image.height, image.channels,
+                                         WHEEL_UNSIGNED_BYTE, params);
+
+      const uint8_t* pixels = image.pixels;
+      uint32_t levels = 1;
+
+      if (params.mipmaps != TEXTURE_MIPMAPS_NONE)
+         levels = std::min(image.levels, mip_level_count(image.width, image.height));
+
+      for (uint32_t level = 0; (result == WHEEL_OK) && (level < levels); ++level)
+      {
+         const uint32_t w = std::max(1u, image.width >> level);
+         const uint32_t h = std::max(1u, image.height >> level);
+
+         result = renderer.UploadTexturePixels(texture, pixels, w, h, image.channels, level);
+         pixels += (size_t)w * h * image.channels;
+      }
+
+      if ((result == WHEEL_OK) && (params.mipmaps == TEXTURE_MIPMAPS_GPU) && (levels == 1))
+         result = renderer.GenerateMipmaps(texture);
+
+      return result;
+   }
+}
@@ -0,0 +1,72 @@
+#ifndef YAM_CAPTURE_H
+#define YAM_CAPTURE_H
+
+#include "common.h"
+#include "threadpool.hpp"
+
+namespace yam
+{
+   // Gets a captured frame on an encoder thread, top row first
+   typedef std::function<void(uint64_t sequence, image_t& image)> capture_callback_t;
+
+   class FrameCapture; extern FrameCapture frame_capture;
+
+   /*
+      Asynchronous framebuffer readback.  Capture() starts copying the
+      active render target into the next pixel pack buffer of a ring and
+      puts a fence after it, without waiting for the GPU.  Collect() maps
+      the buffers whose fences have passed, usually a couple of frames
+      later, and hands the pixels to a background thread that saves them
+      as PNG or passes them to a callback.  Game::Run collects once per
+      frame.
+
+      The ring only stalls when it is full, so it should be at least as
+      deep as the number of frames the GPU runs behind.
+   */
+   class FrameCapture
+   {
+      private:
+         struct slot_t
+         {
+            GLuint               buffer;
+            GLsync               fence;
+
+            uint32_t             width;
+            uint32_t             height;
+            uint64_t             sequence;
+
+            wcl::string          file;
+            capture_callback_t   done;
+
+            slot_t() : buffer(0), fence(0), width(0), height(0), sequence(0) {}
+         };
+
+         std::vector<slot_t>     ring;
+         size_t                  oldest;
+         size_t                  in_flight;
+         uint64_t                sequence;
+
+         ThreadPool              encoder;
+
+         uint32_t          Start(const wcl::string& file, const capture_callback_t& done);
+         uint32_t          Retire(slot_t& slot);
+
+      public:
+         // Reads the render target as it is now, call after drawing and before Swap()
+         uint32_t          Capture(const wcl::string& file);
+         uint32_t          Capture(const capture_callback_t& done);
+
+         // Hands finished readbacks to the encoder and returns how many, wait blocks for all of them
+         uint32_t          Collect(bool wait = false);
+
+         // Collects and encodes everything, then frees the buffers.  Needs the GL context
+         void              Finish();
+
+         size_t            Pending() const { return in_flight; }
+
+         FrameCapture(uint32_t ring_size = 3, uint32_t encode_threads = 1)
+            : ring(std::max(1u, ring_size)), oldest(0), in_flight(0), sequence(0), encoder(encode_threads) {}
+   };
+}
+
+#endif
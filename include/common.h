@@ -73,12 +73,48 @@ namespace yam
       point2d_t(size_t x, size_t y) : x(x), y(y) {}
    };
 
+   // Texture filtering, within a mip level and when magnifying
+   constexpr uint32_t TEXTURE_FILTER_NEAREST = 0;
+   constexpr uint32_t TEXTURE_FILTER_LINEAR  = 1;
+
+   // Where the mip chain of a texture comes from
+   constexpr uint32_t TEXTURE_MIPMAPS_NONE   = 0;
+   constexpr uint32_t TEXTURE_MIPMAPS_GPU    = 1;   // glGenerateMipmap after the upload
+   constexpr uint32_t TEXTURE_MIPMAPS_CPU    = 2;   // box filtered at load time, can be cached
+
+   // How the texels are stored, 8 bits per channel or packed into 16 bits per texel
+   constexpr uint32_t TEXTURE_STORAGE_FULL     = 0;
+   constexpr uint32_t TEXTURE_STORAGE_RGB565   = 1;
+   constexpr uint32_t TEXTURE_STORAGE_RGBA4444 = 2;
+   constexpr uint32_t TEXTURE_STORAGE_RGBA5551 = 3;
+   constexpr uint32_t TEXTURE_STORAGE_16BIT    = 4;   // whichever of the three keeps the alpha of the image
+
+   struct texture_params_t
+   {
+      uint32_t    filter;
+      uint32_t    mipmaps;
+      GLenum      wrap;
+
+      uint32_t    storage;
+      bool        dither;     // ordered dithering when packing into 16 bits
+
+      texture_params_t(uint32_t filter = TEXTURE_FILTER_NEAREST,
+                       uint32_t mipmaps = TEXTURE_MIPMAPS_NONE,
+                       GLenum wrap = GL_CLAMP_TO_EDGE,
+                       uint32_t storage = TEXTURE_STORAGE_FULL,
+                       bool dither = false)
+         : filter(filter), mipmaps(mipmaps), wrap(wrap), storage(storage), dither(dither) {}
+   };
+
    struct texture_t
    {
       uint32_t    id;
       uint32_t    w,h;
       uint32_t    channels;
       uint32_t    format;
+
+      uint32_t    levels;
+      texture_params_t params;
    };
 
    struct image_t
@@ -0,0 +1,73 @@
+#ifndef YAM_CRC32_HPP
+#define YAM_CRC32_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+/*
+   CRC-32 as used by PNG and zlib, eight bytes per step (slice-by-8).
+
+   Works like wcl::update_crc: start with 0xffffffff, feed the data through
+   update_crc32 in as many pieces as needed, and invert the result.
+*/
+
+namespace yam
+{
+   struct crc32_tables_t
+   {
+      uint32_t table[8][256];
+
+      crc32_tables_t()
+      {
+         for (uint32_t n = 0; n < 256; ++n)
+         {
+            uint32_t c = n;
+
+            for (int k = 0; k < 8; ++k)
+               c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+
+            table[0][n] = c;
+         }
+
+         // table[k][n] is the CRC of byte n followed by k zero bytes
+         for (uint32_t n = 0; n < 256; ++n)
+         {
+            for (int k = 1; k < 8; ++k)
+               table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xff];
+         }
+      }
+   };
+
+   inline const crc32_tables_t& crc32_tables()
+   {
+      static const crc32_tables_t tables;
+      return tables;
+   }
+
+   inline uint32_t update_crc32(uint32_t crc, const uint8_t* data, size_t len)
+   {
+      const uint32_t (*t)[256] = crc32_tables().table;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+      for (; len >= 8; len -= 8, data += 8)
+      {
+         uint32_t lo, hi;
+         memcpy(&lo, data, 4);
+         memcpy(&hi, data + 4, 4);
+
+         lo ^= crc;
+
+         crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+             ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+      }
+#endif
+
+      for (; len != 0; --len, ++data)
+         crc = t[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+
+      return crc;
+   }
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define YAM_DEBUG
 
 #include <cstdint>
+#include <ostream>
 #include <wheel_core_string.h>
 
 namespace yam
@@ -22,29 +23,52 @@ namespace yam
          uint32_t  priority;
          uint64_t* frame_ptr;
 
+         // Where the calling thread's lines go instead of std::cout, see set_capture()
+         static std::ostream*& captured()
+         {
+            static thread_local std::ostream* stream = nullptr;
+            return stream;
+         }
+
+         std::ostream& out()
+         {
+            return (captured() != nullptr) ? *captured() : std::cout;
+         }
+
       public:
          void set_stdout(bool value)
          {
             output_to_stdout = value;
          }
 
+         void set_priority(uint32_t value)
+         {
+            priority = value;
+         }
+
          void set_frameptr(const uint64_t* ptr)
          {
             frame_ptr = (uint64_t*)ptr;
          }
 
+         // Collects what the calling thread logs in stream until it's set back to nullptr, for worker threads
+         void set_capture(std::ostream* stream)
+         {
+            captured() = stream;
+         }
+
          OutputTarget() : output_to_stdout(true), priority(0), frame_ptr(nullptr) {}
 
          template <typename T>
          void worf(T fmt)
          {
-            std::cout << fmt;
+            out() << fmt;
          }
 
          template <typename T, typename... Args>
          void worf(T value, Args... args)
          {
-            std::cout << value;
+            out() << value;
             worf(args...);
          }
 
@@ -54,16 +78,19 @@ namespace yam
             if ((log_priority < priority) && log_priority != MESSAGE)
                return;
 
-            if (frame_ptr != nullptr && log_priority != MESSAGE)
+            // The frame counter belongs to the main thread, captured lines go without it
+            if (frame_ptr != nullptr && log_priority != MESSAGE && captured() == nullptr)
                std::cout << "[" << *frame_ptr << "] ";
 
-            if       (log_priority == FATAL)     std::cout << "-\033[1;91m☠\033[0m- ";
-            else if  (log_priority == ERROR)     std::cout << "-\033[1;31m!\033[0m- ";
-            else if  (log_priority == WARNING)   std::cout << "-\033[1;93m!\033[0m- ";
-            else if  (log_priority == FAILURE)   std::cout << "-\033[1;31m✗\033[0m- ";
-            else if  (log_priority == SUCCESS)   std::cout << "-\033[1;32m✔\033[0m- ";
-            else if  (log_priority == NOTE)      std::cout << "-\033[1;94mℹ\033[0m- ";
-            else if  (log_priority == FULL_DEBUG)std::cout << "-\033[1;95mD\033[0m- ";
+            std::ostream& stream = out();
+
+            if       (log_priority == FATAL)     stream << "-\033[1;91m☠\033[0m- ";
+            else if  (log_priority == ERROR)     stream << "-\033[1;31m!\033[0m- ";
+            else if  (log_priority == WARNING)   stream << "-\033[1;93m!\033[0m- ";
+            else if  (log_priority == FAILURE)   stream << "-\033[1;31m✗\033[0m- ";
+            else if  (log_priority == SUCCESS)   stream << "-\033[1;32m✔\033[0m- ";
+            else if  (log_priority == NOTE)      stream << "-\033[1;94mℹ\033[0m- ";
+            else if  (log_priority == FULL_DEBUG)stream << "-\033[1;95mD\033[0m- ";
 
             worf(args...);
          }
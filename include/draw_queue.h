@@ -0,0 +1,169 @@
+#ifndef YAM_DRAW_QUEUE_H
+#define YAM_DRAW_QUEUE_H
+
+#include "common.h"
+
+namespace yam
+{
+   struct vertex_t
+   {
+      float x0, y0;
+      uint16_t s0, t0;
+      uint8_t r, g, b, a;
+
+      vertex_t() {}
+      vertex_t(float x, float y) : x0(x), y0(y) {}
+   };
+
+   // One sprite, expanded to its corners by the vertex shader.  See shaders/sprite.vs
+   struct sprite_instance_t
+   {
+      // Where the pivot goes, in pixels of the target
+      float x, y;
+
+      // Size in pixels, and the pivot measured from the bottom left corner
+      uint16_t w, h;
+      int16_t pivot_x, pivot_y;
+
+      // Radians, counter-clockwise around the pivot
+      float angle;
+
+      // Texture coordinates of the bottom left and top right corners
+      uint16_t s0, t0, s1, t1;
+      uint8_t r, g, b, a;
+   };
+
+   /*
+      Primitive of quads, 4 vertices each, counter-clockwise from the bottom
+      left.  Drawn indexed as triangles, so it's no GL enum, GL_QUADS isn't
+      in the core profile anyway.
+   */
+   constexpr GLenum DRAW_QUADS = 0xf0;
+
+   // Primitive of sprite instances, each one drawn as a strip of 4 vertices
+   constexpr GLenum DRAW_SPRITES = GL_TRIANGLE_STRIP;
+
+   // Where a primitive type draws within a layer and shader, higher ranks first
+   inline uint32_t draw_key_rank(GLenum primitive)
+   {
+      // Quads replace triangles, so they draw where the triangles did
+      if (primitive == DRAW_QUADS)
+         return GL_TRIANGLES;
+
+      return primitive & 0xff;
+   }
+
+   /*
+      Sort key of a draw, compared as one integer:
+
+         63..32   layer, inverted so higher layers draw first
+         31..16   program id, see Renderer::SetShader
+         15..8    rank of the primitive, inverted so triangles draw before lines
+                  and points, like they did in the old std::map
+         7..0     primitive type
+   */
+   inline uint64_t draw_key(uint32_t layer, uint32_t program, GLenum primitive)
+   {
+      return ((uint64_t)~layer << 32) | ((uint64_t)(program & 0xffff) << 16)
+           | ((0xff - draw_key_rank(primitive)) << 8) | (primitive & 0xff);
+   }
+
+   inline uint32_t draw_key_layer(uint64_t key)      { return ~(uint32_t)(key >> 32); }
+   inline uint32_t draw_key_program(uint64_t key)    { return (key >> 16) & 0xffff; }
+   inline GLenum   draw_key_primitive(uint64_t key)  { return key & 0xff; }
+
+   // A run of vertices drawn with the state of key
+   struct draw_command_t
+   {
+      uint64_t          key;
+      uint32_t          first;
+      uint32_t          count;
+   };
+
+   // Sorts by key with an LSD radix sort, equal keys keep their order.  scratch is resized to match
+   void radix_sort(std::vector<draw_command_t>& commands, std::vector<draw_command_t>& scratch);
+
+   /*
+      The draws of a frame.  Elements, vertices or sprite instances, are
+      appended to one stream, and a new command starts whenever the key
+      changes, so consecutive sprites with the same state share a command.
+      Sort() orders the commands by key once per frame and gathers their
+      elements in that order, which turns every run of equal keys into a
+      single batch.  The gather is the only copy the elements get, so it
+      writes straight into mapped GPU memory.
+   */
+   template<typename Element>
+   class BasicDrawQueue
+   {
+      private:
+         std::vector<Element>          elements;
+         std::vector<draw_command_t>   commands;
+         std::vector<draw_command_t>   scratch;
+
+         std::vector<draw_command_t>   batches;
+
+      public:
+         // Room for count elements with key, filled in place.  Valid until the next Reserve() or Add(), null for none
+         inline Element* Reserve(uint64_t key, uint32_t count)
+         {
+            if (count == 0)
+               return nullptr;
+
+            const size_t first = elements.size();
+
+            if (commands.empty() || (commands.back().key != key))
+               commands.push_back({ key, (uint32_t)first, 0 });
+
+            commands.back().count += count;
+            elements.resize(first + count);
+
+            return &elements[first];
+         }
+
+         inline void Add(uint64_t key, const Element& element)
+         {
+            *Reserve(key, 1) = element;
+         }
+
+         // Writes the elements to out in key order, room for Size() of them, and fills Batches()
+         void Sort(Element* out)
+         {
+            radix_sort(commands, scratch);
+
+            batches.clear();
+
+            uint32_t next = 0;
+
+            for (const draw_command_t& command : commands)
+            {
+               memcpy(out + next, &elements[command.first], command.count * sizeof(Element));
+
+               if (!batches.empty() && (batches.back().key == command.key))
+                  batches.back().count += command.count;
+               else
+                  batches.push_back({ command.key, next, command.count });
+
+               next += command.count;
+            }
+         }
+
+         // Ranges of out, one per key
+         const std::vector<draw_command_t>&  Batches() const { return batches; }
+
+         size_t Size() const { return elements.size(); }
+         bool   Empty() const { return elements.empty(); }
+
+         // Starts the next frame, keeps the memory
+         void Clear()
+         {
+            elements.clear();
+            commands.clear();
+            batches.clear();
+         }
+   };
+
+   typedef BasicDrawQueue<vertex_t>             DrawQueue;
+   typedef BasicDrawQueue<sprite_instance_t>    SpriteQueue;
+}
+
+#endif
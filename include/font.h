@@ -7,6 +7,7 @@
 
 #include <wheel.h>
 #include "image.h"
+#include "registry.h"
 
 #define YAM_FONTBUFFER_NAME "__yam_font_buffer"
 #define YAM_FONTBUFFER_SIZE 256
@@ -37,11 +38,17 @@ namespace yam
          static bool          font_init;
          font_type_t          type;
 
+         // Glyphs found in the font atlas so far
+         std::unordered_map<char32_t, sprite_handle_t> glyph_sprites;
+
          Font(const wcl::string& prefix);
 
       public:
          const wheel::string  prefix;
 
+         // Where the glyph is in the font atlas, no handle until it's been put there
+         sprite_handle_t glyph_sprite(char32_t glyph);
+
          virtual int32_t get_advance(char32_t glyph) { return 0; }
          virtual int32_t get_advance_vertical(char32_t glyph) { return 0; }
 
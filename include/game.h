@@ -5,6 +5,10 @@
 #include "shader.h"
 #include "renderer.h"
 
+// Sprites drawn with DrawSprite() are looked up in this atlas
+#define YAM_SPRITEATLAS_NAME "__yam_sprite_atlas"
+#define YAM_SPRITEATLAS_SIZE 2048
+
 namespace yam
 {
    struct gamestate_t
@@ -32,6 +36,10 @@ namespace yam
 
          bool   t_active;
 
+         // The sprite atlas is created with the first sprite, no handle until then
+         atlas_handle_t    sprite_atlas;
+         shader_handle_t   sprite_shader;
+
       protected:
          gamestate_t state;
 
@@ -51,7 +59,8 @@ namespace yam
          // Map from texture name to texture struct
          std::unordered_map<wcl::string, texture_t> textures;
 
-         uint32_t          get_txc(const wcl::string& bname, wheel::rect_t& result);
+         // Where a sprite is in the sprite atlas, and adding RGBA sprites to it
+         uint32_t          get_txc(sprite_handle_t sprite, wheel::rect_t& result);
          uint32_t          atlas_buffer(const wcl::string& bname,
                                         uint32_t w, uint32_t h,
                                         void* data);
@@ -78,9 +87,25 @@ namespace yam
 
          bool              WindowIsOpen();
 
+         /*
+            Draws a sprite of the sprite atlas as one instance with the
+            builtin_sprite shader.  x and y are the bottom left corner,
+            the sprite turns angle radians counter-clockwise around the
+            pivot, which is measured from that corner.  w and h default to
+            the size of the sprite in the atlas.  Sprites drawn every frame
+            should go by handle, see SpriteHandle().
+         */
          uint32_t          DrawSprite(const wcl::string& sprite,
                                       uint32_t x, uint32_t y, uint32_t w = ~0, uint32_t h = ~0,
-                                      int32_t pivot_x = 0, int32_t pivot_y = 0, float angle = .0f);
+                                      int32_t pivot_x = 0, int32_t pivot_y = 0, float angle = .0f,
+                                      uint32_t layer = 0);
+         uint32_t          DrawSprite(sprite_handle_t sprite,
+                                      uint32_t x, uint32_t y, uint32_t w = ~0, uint32_t h = ~0,
+                                      int32_t pivot_x = 0, int32_t pivot_y = 0, float angle = .0f,
+                                      uint32_t layer = 0);
+
+         // No handle for sprites not in the sprite atlas yet
+         sprite_handle_t   SpriteHandle(const wcl::string& sprite);
 
          bool              ok();
 
@@ -6,12 +6,21 @@
 
 namespace yam
 {
+   // Image loading flags
+   constexpr uint32_t IMAGE_BOTTOM_UP  = 0x01;   // store the bottom row first, the way GL wants it
+   constexpr uint32_t IMAGE_TRUSTED    = 0x02;   // from a signed pack file, skip checksum checks
+   constexpr uint32_t IMAGE_MIPMAPS    = 0x04;   // build the mip chain too, ImageCache stores it with the image
+
+   // The flags that change the decoded pixels, the rest only change how they are read
+   constexpr uint32_t IMAGE_LAYOUT_FLAGS = IMAGE_BOTTOM_UP | IMAGE_MIPMAPS;
+
    template<img_format_t T>
-   uint32_t load_to_buffer(image_t& target, const wcl::string& file);
+   uint32_t load_to_buffer(image_t& target, const wcl::string& file, uint32_t flags = 0);
 
    template<img_format_t T>
-   uint32_t load_to_texture(const wcl::string& texture, const wcl::string& file);
+   uint32_t load_to_texture(const wcl::string& texture, const wcl::string& file, uint32_t flags = 0);
 
+   // Flips the image in place
    void flip_vertical(image_t& img);
    void framebuffer_to_image(image_t& img);
 /*
@@ -0,0 +1,514 @@
+#ifndef YAM_BCN_HPP
+#define YAM_BCN_HPP
+
+#include <wheel.h>
+#include <algorithm>
+#include <cmath>
+
+#include "../common.h"
+
+/*
+   Block compression, BC1 (DXT1) for opaque colour, BC3 (DXT5) for colour
+   with alpha and BC4 (RGTC1) for single channel images.
+
+   Every format cuts the image into 4x4 pixel blocks, stored row by row.
+   Blocks hanging over the edge of the image repeat its last column and
+   row.  The encoder fits the colour endpoints along the principal axis
+   of the block and refines them once with least squares, which is good
+   enough for art compressed offline and much simpler than a cluster fit.
+   The decoders are the CPU fallback for drivers without the formats.
+*/
+
+namespace yam
+{
+   constexpr uint32_t TEXTURE_BC1 = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+   constexpr uint32_t TEXTURE_BC3 = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+   constexpr uint32_t TEXTURE_BC4 = GL_COMPRESSED_RED_RGTC1;
+
+   // Bytes per 4x4 block, 0 for formats that aren't block compressed
+   inline uint32_t bcn_block_bytes(uint32_t format)
+   {
+      if ((format == TEXTURE_BC1) || (format == TEXTURE_BC4))
+         return 8;
+      else if (format == TEXTURE_BC3)
+         return 16;
+
+      return 0;
+   }
+
+   // Channels the format decodes to
+   inline uint32_t bcn_channels(uint32_t format)
+   {
+      if (format == TEXTURE_BC1)
+         return 3;
+      else if (format == TEXTURE_BC3)
+         return 4;
+      else if (format == TEXTURE_BC4)
+         return 1;
+
+      return 0;
+   }
+
+   inline size_t bcn_level_size(uint32_t format, uint32_t w, uint32_t h)
+   {
+      return (size_t)((w + 3) / 4) * ((h + 3) / 4) * bcn_block_bytes(format);
+   }
+
+   inline uint16_t bcn_pack_565(float r, float g, float b)
+   {
+      auto quantize = [](float v, float max)
+      {
+         return (uint32_t)std::min(max, std::max(0.0f, v * max / 255.0f + 0.5f));
+      };
+
+      return (quantize(r, 31) << 11) | (quantize(g, 63) << 5) | quantize(b, 31);
+   }
+
+   inline void bcn_unpack_565(uint16_t c, int32_t rgb[3])
+   {
+      const int32_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+
+      rgb[0] = (r << 3) | (r >> 2);
+      rgb[1] = (g << 2) | (g >> 4);
+      rgb[2] = (b << 3) | (b >> 2);
+   }
+
+   // The four colours of a 4 colour mode block
+   inline void bcn_palette(uint16_t c0, uint16_t c1, int32_t palette[4][3])
+   {
+      bcn_unpack_565(c0, palette[0]);
+      bcn_unpack_565(c1, palette[1]);
+
+      for (int i = 0; i < 3; ++i)
+      {
+         palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+         palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+      }
+   }
+
+   // Picks the closest palette entry for every pixel, returns the total squared error
+   inline uint32_t bcn_colour_indices(const uint8_t rgba[64], uint16_t c0, uint16_t c1, uint32_t* indices)
+   {
+      int32_t palette[4][3];
+      bcn_palette(c0, c1, palette);
+
+      uint32_t error = 0;
+      *indices = 0;
+
+      for (int p = 0; p < 16; ++p)
+      {
+         uint32_t best = ~0u, best_index = 0;
+
+         for (uint32_t i = 0; i < 4; ++i)
+         {
+            const int32_t dr = rgba[p * 4 + 0] - palette[i][0];
+            const int32_t dg = rgba[p * 4 + 1] - palette[i][1];
+            const int32_t db = rgba[p * 4 + 2] - palette[i][2];
+            const uint32_t d = dr * dr + dg * dg + db * db;
+
+            if (d < best)
+            {
+               best = d;
+               best_index = i;
+            }
+         }
+
+         *indices |= best_index << (p * 2);
+         error += best;
+      }
+
+      return error;
+   }
+
+   // Endpoints that fit the pixels best for fixed indices, by least squares
+   inline bool bcn_refit_endpoints(const uint8_t rgba[64], uint32_t indices, uint16_t* c0, uint16_t* c1)
+   {
+      static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+      float aa = 0, bb = 0, ab = 0;
+      float ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+
+      for (int p = 0; p < 16; ++p)
+      {
+         const float a = weights[(indices >> (p * 2)) & 3];
+         const float b = 1.0f - a;
+
+         aa += a * a;
+         bb += b * b;
+         ab += a * b;
+
+         for (int i = 0; i < 3; ++i)
+         {
+            ax[i] += a * rgba[p * 4 + i];
+            bx[i] += b * rgba[p * 4 + i];
+         }
+      }
+
+      const float det = aa * bb - ab * ab;
+
+      if (std::fabs(det) < 1e-6f)
+         return false;
+
+      float e0[3], e1[3];
+
+      for (int i = 0; i < 3; ++i)
+      {
+         e0[i] = (ax[i] * bb - bx[i] * ab) / det;
+         e1[i] = (bx[i] * aa - ax[i] * ab) / det;
+      }
+
+      *c0 = bcn_pack_565(e0[0], e0[1], e0[2]);
+      *c1 = bcn_pack_565(e1[0], e1[1], e1[2]);
+
+      return true;
+   }
+
+   // Turns axis towards the principal axis of the covariance cov, false if it collapses to nothing
+   inline bool bcn_principal_axis(const float cov[6], float axis[3])
+   {
+      for (int iteration = 0; iteration < 8; ++iteration)
+      {
+         const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+         const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+         const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+         const float length = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+
+         if (length < 1e-6f)
+            return false;
+
+         axis[0] = x / length;
+         axis[1] = y / length;
+         axis[2] = z / length;
+      }
+
+      return true;
+   }
+
+   // 8 byte colour block in 4 colour mode, the alpha of rgba is ignored
+   inline void bc1_encode_block(const uint8_t rgba[64], uint8_t* out)
+   {
+      float mean[3] = { 0, 0, 0 };
+
+      for (int p = 0; p < 16; ++p)
+      {
+         for (int i = 0; i < 3; ++i)
+            mean[i] += rgba[p * 4 + i] / 16.0f;
+      }
+
+      float cov[6] = { 0, 0, 0, 0, 0, 0 };
+
+      for (int p = 0; p < 16; ++p)
+      {
+         const float r = rgba[p * 4 + 0] - mean[0];
+         const float g = rgba[p * 4 + 1] - mean[1];
+         const float b = rgba[p * 4 + 2] - mean[2];
+
+         cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+         cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+      }
+
+      /*
+         Principal axis by power iteration, seeded with the covariances of
+         the channel that varies most.  A fixed seed like (1, 1, 1) is
+         orthogonal to the axis of a block mixing two primaries, red and
+         green say, and would flatten it to its mean colour.  A flat block
+         keeps no axis at all.
+      */
+      static const int column[3][3] = { { 0, 1, 2 }, { 1, 3, 4 }, { 2, 4, 5 } };
+
+      int seeds[3] = { 0, 1, 2 };
+      std::sort(seeds, seeds + 3, [&](int a, int b) { return cov[column[a][a]] > cov[column[b][b]]; });
+
+      float axis[3] = { 0, 0, 0 };
+
+      for (int seed : seeds)
+      {
+         if (cov[column[seed][seed]] < 1e-6f)
+            break;
+
+         for (int i = 0; i < 3; ++i)
+            axis[i] = cov[column[seed][i]];
+
+         if (bcn_principal_axis(cov, axis))
+            break;
+
+         axis[0] = axis[1] = axis[2] = 0;
+      }
+
+      float lo = 1e30f, hi = -1e30f;
+
+      for (int p = 0; p < 16; ++p)
+      {
+         const float t = (rgba[p * 4 + 0] - mean[0]) * axis[0]
+                       + (rgba[p * 4 + 1] - mean[1]) * axis[1]
+                       + (rgba[p * 4 + 2] - mean[2]) * axis[2];
+
+         lo = std::min(lo, t);
+         hi = std::max(hi, t);
+      }
+
+      const float norm = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+      if (norm > 1e-6f)
+      {
+         lo /= norm;
+         hi /= norm;
+      }
+
+      uint16_t c0 = bcn_pack_565(mean[0] + axis[0] * hi, mean[1] + axis[1] * hi, mean[2] + axis[2] * hi);
+      uint16_t c1 = bcn_pack_565(mean[0] + axis[0] * lo, mean[1] + axis[1] * lo, mean[2] + axis[2] * lo);
+
+      uint32_t indices;
+      uint32_t error = bcn_colour_indices(rgba, c0, c1, &indices);
+
+      uint16_t r0, r1;
+
+      if (bcn_refit_endpoints(rgba, indices, &r0, &r1))
+      {
+         uint32_t refit_indices;
+         uint32_t refit_error = bcn_colour_indices(rgba, r0, r1, &refit_indices);
+
+         if (refit_error < error)
+         {
+            c0 = r0;
+            c1 = r1;
+            indices = refit_indices;
+         }
+      }
+
+      // c0 > c1 selects the 4 colour mode, swapping the endpoints swaps indices 0-1 and 2-3
+      if (c0 < c1)
+      {
+         std::swap(c0, c1);
+         indices ^= 0x55555555;
+      } else if (c0 == c1) {
+         indices = 0;
+      }
+
+      out[0] = c0; out[1] = c0 >> 8;
+      out[2] = c1; out[3] = c1 >> 8;
+      out[4] = indices; out[5] = indices >> 8;
+      out[6] = indices >> 16; out[7] = indices >> 24;
+   }
+
+   // 8 byte single channel block, BC4 and the alpha half of BC3, values are 4 bytes apart
+   inline void bc4_encode_block(const uint8_t* values, uint8_t* out)
+   {
+      uint8_t lo = 255, hi = 0;
+
+      for (int p = 0; p < 16; ++p)
+      {
+         lo = std::min(lo, values[p * 4]);
+         hi = std::max(hi, values[p * 4]);
+      }
+
+      out[0] = hi;
+      out[1] = lo;
+
+      uint64_t indices = 0;
+
+      // With hi > lo the block has 8 values, index 0 is hi, 1 is lo and 2-7 are in between
+      if (hi != lo)
+      {
+         int32_t palette[8] = { hi, lo };
+
+         for (int i = 1; i < 7; ++i)
+            palette[i + 1] = ((7 - i) * hi + i * lo) / 7;
+
+         for (int p = 0; p < 16; ++p)
+         {
+            int32_t best = 256;
+            uint64_t best_index = 0;
+
+            for (int i = 0; i < 8; ++i)
+            {
+               const int32_t d = std::abs(values[p * 4] - palette[i]);
+
+               if (d < best)
+               {
+                  best = d;
+                  best_index = i;
+               }
+            }
+
+            indices |= best_index << (p * 3);
+         }
+      }
+
+      for (int i = 0; i < 6; ++i)
+         out[2 + i] = indices >> (i * 8);
+   }
+
+   inline void bc1_decode_block(const uint8_t* block, uint8_t rgba[64])
+   {
+      const uint16_t c0 = block[0] | (block[1] << 8);
+      const uint16_t c1 = block[2] | (block[3] << 8);
+      const uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+
+      int32_t palette[4][3];
+      bcn_palette(c0, c1, palette);
+
+      // 3 colour mode, the last colour is black
+      if (c0 <= c1)
+      {
+         for (int i = 0; i < 3; ++i)
+         {
+            palette[2][i] = (palette[0][i] + palette[1][i]) / 2;
+            palette[3][i] = 0;
+         }
+      }
+
+      for (int p = 0; p < 16; ++p)
+      {
+         const uint32_t index = (indices >> (p * 2)) & 3;
+
+         rgba[p * 4 + 0] = palette[index][0];
+         rgba[p * 4 + 1] = palette[index][1];
+         rgba[p * 4 + 2] = palette[index][2];
+         rgba[p * 4 + 3] = 255;
+      }
+   }
+
+   inline void bc4_decode_block(const uint8_t* block, uint8_t* values)
+   {
+      const int32_t a0 = block[0], a1 = block[1];
+      int32_t palette[8] = { a0, a1 };
+
+      if (a0 > a1)
+      {
+         for (int i = 1; i < 7; ++i)
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+      } else {
+         for (int i = 1; i < 5; ++i)
+            palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+
+         palette[6] = 0;
+         palette[7] = 255;
+      }
+
+      uint64_t indices = 0;
+
+      for (int i = 0; i < 6; ++i)
+         indices |= (uint64_t)block[2 + i] << (i * 8);
+
+      for (int p = 0; p < 16; ++p)
+         values[p * 4] = palette[(indices >> (p * 3)) & 7];
+   }
+
+   // Gathers the block at bx, by as RGBA, repeating the last column and row of the image
+   inline void bcn_fetch_block(const image_t& src, uint32_t bx, uint32_t by, uint8_t rgba[64])
+   {
+      for (uint32_t y = 0; y < 4; ++y)
+      {
+         const uint32_t sy = std::min(by * 4 + y, src.height - 1);
+
+         for (uint32_t x = 0; x < 4; ++x)
+         {
+            const uint32_t sx = std::min(bx * 4 + x, src.width - 1);
+            const uint8_t* pixel = &src.image[((size_t)sy * src.width + sx) * src.channels];
+            uint8_t* out = rgba + (y * 4 + x) * 4;
+
+            if (src.channels < 3)
+            {
+               out[0] = out[1] = out[2] = pixel[0];
+               out[3] = (src.channels == 2) ? pixel[1] : 255;
+            } else {
+               out[0] = pixel[0];
+               out[1] = pixel[1];
+               out[2] = pixel[2];
+               out[3] = (src.channels == 4) ? pixel[3] : 255;
+            }
+         }
+      }
+   }
+
+   // Compresses a whole image, BC4 takes the first channel
+   inline uint32_t compress_bcn(const image_t& src, uint32_t format, wcl::buffer_t& output)
+   {
+      const uint32_t block_bytes = bcn_block_bytes(format);
+
+      if ((block_bytes == 0) || (src.width == 0) || (src.height == 0)
+      || (src.channels < 1) || (src.channels > 4))
+      {
+         log(ERROR, "Can't block compress a ", src.width, "x", src.height, " image with ",
+             src.channels, " channels\n");
+         return WHEEL_INVALID_VALUE;
+      }
+
+      const uint32_t blocks_x = (src.width + 3) / 4;
+      const uint32_t blocks_y = (src.height + 3) / 4;
+
+      output.resize((size_t)blocks_x * blocks_y * block_bytes);
+      uint8_t* out = &output[0];
+
+      uint8_t rgba[64];
+
+      for (uint32_t by = 0; by < blocks_y; ++by)
+      {
+         for (uint32_t bx = 0; bx < blocks_x; ++bx, out += block_bytes)
+         {
+            bcn_fetch_block(src, bx, by, rgba);
+
+            if (format == TEXTURE_BC1)
+            {
+               bc1_encode_block(rgba, out);
+            } else if (format == TEXTURE_BC3) {
+               bc4_encode_block(rgba + 3, out);
+               bc1_encode_block(rgba, out + 8);
+            } else {
+               bc4_encode_block(rgba, out);
+            }
+         }
+      }
+
+      return WHEEL_OK;
+   }
+
+   // Decodes a compressed image into as many channels as the format has
+   inline uint32_t decompress_bcn(const uint8_t* data, uint32_t w, uint32_t h, uint32_t format, image_t& target)
+   {
+      const uint32_t block_bytes = bcn_block_bytes(format);
+
+      if (block_bytes == 0)
+         return WHEEL_INVALID_FORMAT;
+
+      target.width = w;
+      target.height = h;
+      target.channels = bcn_channels(format);
+      target.image.resize((size_t)w * h * target.channels);
+
+      const uint32_t blocks_x = (w + 3) / 4;
+      const uint32_t blocks_y = (h + 3) / 4;
+
+      uint8_t rgba[64];
+
+      for (uint32_t by = 0; by < blocks_y; ++by)
+      {
+         for (uint32_t bx = 0; bx < blocks_x; ++bx, data += block_bytes)
+         {
+            if (format == TEXTURE_BC1)
+            {
+               bc1_decode_block(data, rgba);
+            } else if (format == TEXTURE_BC3) {
+               bc1_decode_block(data + 8, rgba);
+               bc4_decode_block(data, rgba + 3);
+            } else {
+               bc4_decode_block(data, rgba);
+            }
+
+            for (uint32_t y = 0; (y < 4) && (by * 4 + y < h); ++y)
+            {
+               for (uint32_t x = 0; (x < 4) && (bx * 4 + x < w); ++x)
+               {
+                  uint8_t* pixel = &target.image[((size_t)(by * 4 + y) * w + bx * 4 + x) * target.channels];
+                  memcpy(pixel, rgba + (y * 4 + x) * 4, target.channels);
+               }
+            }
+         }
+      }
+
+      return WHEEL_OK;
+   }
+}
+
+#endif
@@ -2,9 +2,14 @@
 #define YAM_PNG_HPP
 
 #include <wheel.h>
+#include <functional>
+#include <thread>
+#include <cstdio>
 
 #include "../image.h"
 #include "../renderer.h"
+#include "png_filter.hpp"
+#include "../crc32.hpp"
 
 #define MINIZ_HEADER_FILE_ONLY
 #include "../../deps/miniz.c"
@@ -13,15 +18,8 @@
 
 namespace yam
 {
-   struct PNGChunk
-   {
-      uint32_t       len;
-      char           type[4];
-      wcl::buffer_t  data;
-      uint32_t crc;
-   };
-
-   inline size_t z_compress(const void* src, size_t len, wcl::buffer_t& destination)
+   inline size_t z_compress(const void* src, size_t len, wcl::buffer_t& destination,
+                            int level = Z_BEST_COMPRESSION)
    {
       z_stream stream;
 
@@ -31,12 +29,13 @@ namespace yam
 
       stream.zalloc = Z_NULL;
       stream.zfree = Z_NULL;
+      stream.opaque = Z_NULL;
       stream.next_in = (uint8_t*)src;
       stream.avail_in = len;
       stream.next_out = temp_buffer;
       stream.avail_out = ZLIB_CHUNK;
 
-      deflateInit(&stream, Z_BEST_COMPRESSION);
+      deflateInit(&stream, level);
 
       while (stream.avail_in != 0)
       {
@@ -112,6 +111,12 @@ namespace yam
          ret = inflate(&stream, Z_NO_FLUSH);
 
          buffer.insert(buffer.end(), temp_buffer, temp_buffer + ZLIB_CHUNK - stream.avail_out);
+
+         if ((ret != Z_OK) && (ret != Z_STREAM_END))
+         {
+            log(ERROR, "zlib error: corrupt or truncated stream\n");
+            break;
+         }
       }
 
       (void)inflateEnd(&stream);
@@ -128,228 +133,654 @@ namespace yam
       return z_uncompress(&source[0], source.size() - 1, destination);
    }
 
+   // View of one chunk in the source buffer
+   struct png_chunk_t
+   {
+      char        type[4];
+      size_t      offset;
+      uint32_t    len;
+
+      inline bool is(const char* name) const
+      {
+         return memcmp(type, name, 4) == 0;
+      }
+   };
+
+   typedef std::vector<png_chunk_t> png_chunk_index_t;
+
+   inline uint32_t png_read_u32(const uint8_t* p)
+   {
+      return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+   }
+
+   inline const png_chunk_t* png_find_chunk(const png_chunk_index_t& chunks, const char* name)
+   {
+      for (const png_chunk_t& chunk : chunks)
+      {
+         if (chunk.is(name))
+            return &chunk;
+      }
+
+      return nullptr;
+   }
+
    /*
-      PNG functions
+      Walks the chunks of a PNG file without copying or touching the source
+      buffer.  Chunks failing the CRC check are left out of the index, unless
+      flags has IMAGE_TRUSTED, which skips the check altogether.
    */
-   inline uint32_t read_png(const wcl::buffer_t& data, uint32_t* w = nullptr, uint32_t* h = nullptr,
-                     uint32_t* c = nullptr, wcl::buffer_t* target = nullptr,
-                     palette_t* palette = nullptr)
+   inline uint32_t png_index_chunks(const wcl::buffer_t& data, png_chunk_index_t& chunks,
+                                    uint32_t flags = 0)
    {
-      uint32_t nw, nh, nc;
-      if (w == nullptr)
-         w = &nw;
-      if (h == nullptr)
-         h = &nh;
-      if (c == nullptr)
-         c = &nc;
+      static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
 
-      std::vector<PNGChunk*> chunks;
+      const size_t size = data.size();
 
-      wcl::buffer_t& buffer = (wcl::buffer_t&)data;
-      buffer.seek(8);
+      if ((size < 8) || (memcmp(&data[0], signature, 8) != 0))
+      {
+         log(ERROR, "Not a PNG file\n");
+         return WHEEL_INVALID_FORMAT;
+      }
+
+      const uint8_t* src = &data[0];
+      size_t pos = 8;
 
-      while(buffer.pos() < buffer.size())
+      chunks.clear();
+      chunks.reserve(16);
+
+      while (pos < size)
       {
-         PNGChunk* next = new PNGChunk;
+         if (size - pos < 8)
+         {
+            log(ERROR, "Abrupt end of memory buffer: can't read PNG chunk header\n");
+            return WHEEL_UNEXPECTED_END_OF_FILE;
+         }
+
+         png_chunk_t chunk;
+
+         chunk.len = png_read_u32(src + pos);
+         memcpy(chunk.type, src + pos + 4, 4);
+         chunk.offset = pos + 8;
 
-         if (!buffer.can_read(sizeof(next->len)))
+         if (size - chunk.offset < (size_t)chunk.len + 4)
          {
-            delete next;
-            log(ERROR, "Abrupt end of memory buffer: can't read PNG chunk length\n");
+            log(ERROR, "Abrupt end of memory buffer: can't read PNG chunk data\n");
             return WHEEL_UNEXPECTED_END_OF_FILE;
          }
 
-         next->len = buffer.read_le<uint32_t>();
+         const uint8_t* crc_start = src + pos + 4;
+
+         pos = chunk.offset + chunk.len + 4;
 
-         if (!buffer.can_read(sizeof(next->type)))
+         if (!(flags & IMAGE_TRUSTED))
          {
-            delete next;
-            log(ERROR, "Abrupt end of memory buffer: can't read PNG chunk type\n");
+            // type and data are contiguous in the file, the CRC covers both
+            uint32_t crc = png_read_u32(src + chunk.offset + chunk.len);
+            uint32_t crc_check = 0xffffffff;
+            crc_check = update_crc32(crc_check, crc_start, chunk.len + 4);
+            crc_check ^= 0xffffffff;
+
+            if (crc != crc_check)
+            {
+               log(WARNING, "Ignored PNG chunk: ", wcl::string(chunk.type, 4), ", failed CRC check\n");
+               continue;
+            }
          }
 
-         strncpy(next->type, (const char*)(&buffer[0] + buffer.pos()), 4);
-         wcl::string s(next->type, 4);
-         buffer.seek(buffer.pos() + 4);
+         chunks.push_back(chunk);
+
+         if (chunk.is("IEND"))
+            break;
+      }
+
+      return WHEEL_OK;
+   }
+
+   // Image layout from IHDR
+   struct png_header_t
+   {
+      uint32_t    width;
+      uint32_t    height;
+      uint32_t    channels;
+
+      uint8_t     depth;
+      uint8_t     colour_type;
+      uint8_t     interlace;
 
-         if (!buffer.can_read(next->len))
+      // Bytes in one filtered scanline of the given width, without the filter type byte
+      inline size_t raw_stride(uint32_t w) const
+      {
+         return ((size_t)w * channels * depth + 7) / 8;
+      }
+
+      // Distance from a byte to the same byte of the pixel on its left
+      inline size_t filter_bpp() const
+      {
+         return (channels * depth < 8) ? 1 : channels * depth / 8;
+      }
+   };
+
+   /*
+      Sample depth conversion to the 8 bit layout textures use.
+
+      1, 2 and 4 bit samples are expanded a whole source byte at a time
+      through a lookup table.  Greyscale is scaled to the full 0-255 range,
+      palette indices are kept as they are.  16 bit samples keep their high
+      byte.
+   */
+   struct png_expand_table_t
+   {
+      uint8_t     entry[256][8];
+      uint32_t    per_byte;
+   };
+
+   inline void png_build_expand_table(png_expand_table_t& table, uint8_t depth, bool scale)
+   {
+      const uint32_t mask = (1 << depth) - 1;
+      const uint32_t factor = scale ? 255 / mask : 1;
+
+      table.per_byte = 8 / depth;
+
+      for (uint32_t b = 0; b < 256; ++b)
+      {
+         for (uint32_t k = 0; k < table.per_byte; ++k)
+            table.entry[b][k] = ((b >> (8 - depth * (k + 1))) & mask) * factor;
+      }
+   }
+
+   inline void png_expand_low_depth(const png_expand_table_t& table, const uint8_t* raw,
+                                    uint8_t* out, size_t samples)
+   {
+      const size_t full = samples / table.per_byte;
+
+      if (table.per_byte == 8)
+      {
+         for (size_t i = 0; i < full; ++i)
+            memcpy(out + 8 * i, table.entry[raw[i]], 8);
+      } else if (table.per_byte == 4) {
+         for (size_t i = 0; i < full; ++i)
+            memcpy(out + 4 * i, table.entry[raw[i]], 4);
+      } else {
+         for (size_t i = 0; i < full; ++i)
+            memcpy(out + 2 * i, table.entry[raw[i]], 2);
+      }
+
+      if (samples % table.per_byte)
+         memcpy(out + full * table.per_byte, table.entry[raw[full]], samples % table.per_byte);
+   }
+
+   inline void png_expand_16(const uint8_t* raw, uint8_t* out, size_t samples)
+   {
+      size_t i = 0;
+
+#if defined(__SSE2__)
+      // Samples are big endian, so the high byte is the low half of each 16 bit lane
+      const __m128i mask = _mm_set1_epi16(0x00ff);
+
+      for (; i + 16 <= samples; i += 16)
+      {
+         __m128i lo = _mm_and_si128(_mm_loadu_si128((const __m128i*)(raw + 2 * i)), mask);
+         __m128i hi = _mm_and_si128(_mm_loadu_si128((const __m128i*)(raw + 2 * i + 16)), mask);
+
+         _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+      }
+#endif
+      for (; i < samples; ++i)
+         out[i] = raw[2 * i];
+   }
+
+   /*
+      Pulls inflated bytes out of the IDAT chunks of a chunk index.  The
+      chunks are fed to the inflater straight from the source buffer, one at
+      a time, so nothing gets inflated before it is asked for.
+   */
+   class png_inflater_t
+   {
+      private:
+         z_stream                   stream;
+         const wcl::buffer_t&       data;
+         const png_chunk_index_t&   chunks;
+
+         size_t                     next_chunk;
+         bool                       more_input;
+         bool                       ready;
+
+      public:
+         png_inflater_t(const wcl::buffer_t& data, const png_chunk_index_t& chunks)
+            : data(data), chunks(chunks), next_chunk(0), more_input(true)
          {
-            delete next;
-            log(ERROR, "Abrupt end of memory buffer: can't read PNG chunk data\n");
-            return WHEEL_UNEXPECTED_END_OF_FILE;
+            stream.zalloc = Z_NULL;
+            stream.zfree = Z_NULL;
+            stream.opaque = Z_NULL;
+            stream.avail_in = 0;
+            stream.next_in = Z_NULL;
+
+            ready = (inflateInit(&stream) == Z_OK);
+
+            if (!ready)
+               log(ERROR, "zlib error: inflating failed\n");
          }
 
-         next->data.resize(next->len);
-         memcpy(&(next->data[0]), (&buffer[0] + buffer.pos()), next->len);
-         buffer.seek(buffer.pos() + next->len);
+        ~png_inflater_t()
+         {
+            if (ready)
+               inflateEnd(&stream);
+         }
 
-         if (!buffer.can_read(sizeof(next->crc)))
+         uint32_t read(uint8_t* out, size_t len)
          {
-            delete next;
-            log(ERROR, "Abrupt end of memory buffer: can't read PNG chunk crc\n");
-            return WHEEL_UNEXPECTED_END_OF_FILE;
+            if (!ready)
+               return WHEEL_ERROR;
+
+            stream.next_out = out;
+            stream.avail_out = len;
+
+            while (stream.avail_out != 0)
+            {
+               while ((stream.avail_in == 0) && more_input)
+               {
+                  while ((next_chunk < chunks.size()) && !chunks[next_chunk].is("IDAT"))
+                     next_chunk++;
+
+                  if (next_chunk == chunks.size())
+                  {
+                     more_input = false;
+                     break;
+                  }
+
+                  stream.next_in = (uint8_t*)&data[0] + chunks[next_chunk].offset;
+                  stream.avail_in = chunks[next_chunk].len;
+                  next_chunk++;
+               }
+
+               int ret = inflate(&stream, Z_NO_FLUSH);
+
+               if (stream.avail_out == 0)
+                  break;
+
+               if ((ret == Z_STREAM_END)
+               || ((ret == Z_BUF_ERROR) && (stream.avail_in == 0) && !more_input))
+                  return WHEEL_UNEXPECTED_END_OF_FILE;
+
+               if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+               {
+                  log(ERROR, "zlib error: corrupt PNG image data\n");
+                  return WHEEL_INVALID_FORMAT;
+               }
+            }
+
+            return WHEEL_OK;
          }
+   };
+
+   // Called after each Adam7 pass with the number of the pass (1-7) and the image so far
+   typedef std::function<void(uint32_t pass, const wcl::buffer_t& image)> png_progress_t;
+
+   // Decoder flags, on top of the IMAGE_* ones
+   constexpr uint32_t PNG_WRITE_ONLY   = 0x100;  // target is mapped GL memory, never read from it
+
+   struct png_pass_t
+   {
+      uint32_t x0, y0;
+      uint32_t dx, dy;
+
+      // Size of the rectangle a pixel of this pass stands for in a progressive preview
+      inline uint32_t block_w() const { return x0 ? x0 : dx; }
+      inline uint32_t block_h() const { return y0 ? y0 : dy; }
+   };
+
+   static const png_pass_t png_adam7[7] = {
+      { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+      { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 }
+   };
+
+   static const png_pass_t png_single_pass = { 0, 0, 1, 1 };
+
+   // Writes a pass row to every step:th pixel of an image row, count times each
+   template<size_t N>
+   inline void png_scatter_pixels(const uint8_t* src, uint8_t* dst, uint32_t pixels,
+                                  size_t step, uint32_t count)
+   {
+      for (uint32_t i = 0; i < pixels; ++i, src += N, dst += step)
+      {
+         uint8_t* block = dst;
+
+         for (uint32_t k = 0; k < count; ++k, block += N)
+            memcpy(block, src, N);
+      }
+   }
+
+   /*
+      Spreads one reconstructed pass row over its image row.  With block_w
+      above 1 every pixel is repeated over block_w pixels, clipped to the
+      image, so that a preview has no holes.
+   */
+   inline void png_scatter_row(const uint8_t* src, uint8_t* row, const png_header_t& header,
+                               const png_pass_t& pass, uint32_t pixels, uint32_t block_w)
+   {
+      const size_t bpp = header.channels;
+
+      // The block of the last pixel may be cut off by the right edge
+      uint32_t last_w = std::min(block_w, header.width - (pass.x0 + (pixels - 1) * pass.dx));
+      uint32_t full = (last_w == block_w) ? pixels : pixels - 1;
+
+      uint8_t* dst = row + pass.x0 * bpp;
+      const size_t step = pass.dx * bpp;
+
+      if (bpp == 1)
+         png_scatter_pixels<1>(src, dst, full, step, block_w);
+      else if (bpp == 2)
+         png_scatter_pixels<2>(src, dst, full, step, block_w);
+      else if (bpp == 3)
+         png_scatter_pixels<3>(src, dst, full, step, block_w);
+      else
+         png_scatter_pixels<4>(src, dst, full, step, block_w);
+
+      if (full != pixels)
+      {
+         src += full * bpp;
+         dst += full * step;
+
+         for (uint32_t k = 0; k < last_w; ++k, dst += bpp)
+            memcpy(dst, src, bpp);
+      }
+   }
+
+   /*
+      Inflates the image data and reconstructs every scanline as soon as all
+      of its bytes are in, so there is never more than the output image and
+      the inflate state in memory.
+
+      Row y of the image goes to target + pitch * y, so a negative pitch
+      stores the image bottom-up.
+
+      Non-interlaced 8 bit scanlines are inflated and reconstructed in place
+      in the target, unless the target is PNG_WRITE_ONLY.  Everything else
+      goes through two scanline sized scratch rows, and each row is expanded
+      and/or scattered into the target right after it has been
+      reconstructed.
+
+      Adam7 pass rows are spread into the image with block copies.  When
+      there is a pass_done callback, every pass pixel is also repeated over
+      the rectangle later passes will fill in, and the callback is called
+      after every pass.
+   */
+   inline uint32_t png_decode_rows(const wcl::buffer_t& data, const png_chunk_index_t& chunks,
+                                   const png_header_t& header, uint8_t* target, ptrdiff_t pitch,
+                                   uint32_t flags = 0,
+                                   const std::function<void(uint32_t pass)>& pass_done = nullptr)
+   {
+      const size_t stride = (size_t)header.width * header.channels;
+      const size_t max_raw_stride = header.raw_stride(header.width);
+      const size_t bpp = header.filter_bpp();
+      const bool interlaced = (header.interlace == 1);
+      const bool direct = (header.depth == 8) && !interlaced && !(flags & PNG_WRITE_ONLY);
+
+      png_expand_table_t table;
+
+      if (header.depth < 8)
+         png_build_expand_table(table, header.depth, header.colour_type == 0);
+
+      png_inflater_t inflater(data, chunks);
+
+      // The row above the first one is all zeroes, followed by the scratch rows if needed
+      wcl::buffer_t rows;
+      rows.resize(direct ? max_raw_stride : 3 * max_raw_stride + (interlaced ? stride : 0));
+
+      uint8_t* zero_row = &rows[0];
+      uint8_t* raw = direct ? nullptr : &rows[max_raw_stride];
+      uint8_t* raw_next = direct ? nullptr : &rows[2 * max_raw_stride];
+      uint8_t* pass_row = interlaced ? &rows[3 * max_raw_stride] : nullptr;
 
-         next->crc = buffer.read_le<uint32_t>();
-         uint32_t crc_check = 0xffffffff;
-         crc_check = wcl::update_crc(crc_check, (uint8_t*)next->type, sizeof(uint32_t));
-         crc_check = wcl::update_crc(crc_check, (uint8_t*)&(next->data[0]), next->len);
-         crc_check ^= 0xffffffff;
+      const uint32_t pass_count = interlaced ? 7 : 1;
 
-         if (next->crc == crc_check)
+      for (uint32_t p = 0; p < pass_count; ++p)
+      {
+         const png_pass_t& pass = interlaced ? png_adam7[p] : png_single_pass;
+
+         const uint32_t pass_w = (header.width + pass.dx - 1 - pass.x0) / pass.dx;
+         const uint32_t pass_h = (header.height + pass.dy - 1 - pass.y0) / pass.dy;
+
+         // Empty passes have no scanlines at all, not even filter bytes
+         if ((header.width <= pass.x0) || (header.height <= pass.y0))
+            continue;
+
+         const size_t raw_stride = header.raw_stride(pass_w);
+         const size_t pass_stride = (size_t)pass_w * header.channels;
+
+         const uint32_t block_w = pass_done ? pass.block_w() : 1;
+         const uint32_t block_h = pass_done ? pass.block_h() : 1;
+
+         const uint8_t* prev = zero_row;
+
+         for (uint32_t row = 0; row < pass_h; ++row)
          {
-            chunks.push_back(next);
-            if (s == "IEND")
-               break;
-         } else {
-            log(WARNING, "Ignored PNG chunk: ", s, ", failed CRC check\n");
-            delete next;
+            const uint32_t y = pass.y0 + row * pass.dy;
+
+            uint8_t* dst = target + pitch * (ptrdiff_t)y;
+            uint8_t* scanline = direct ? dst : raw;
+            uint8_t scanline_filter;
+
+            uint32_t result = inflater.read(&scanline_filter, 1);
+
+            if (result == WHEEL_OK)
+               result = inflater.read(scanline, raw_stride);
+
+            if (result != WHEEL_OK)
+            {
+               if ((result == WHEEL_UNEXPECTED_END_OF_FILE) && interlaced)
+                  log(ERROR, "Truncated PNG image data: got ", row, " of ", pass_h, " rows in pass ", p + 1, "\n");
+               else if (result == WHEEL_UNEXPECTED_END_OF_FILE)
+                  log(ERROR, "Truncated PNG image data: got ", row, " of ", pass_h, " rows\n");
+
+               return result;
+            }
+
+            if (!png_unfilter_row(scanline_filter, scanline, scanline, prev, raw_stride, bpp))
+            {
+               log(ERROR, "Invalid PNG filter type ", (uint32_t)scanline_filter, " on row ", row, "\n");
+               return WHEEL_INVALID_FORMAT;
+            }
+
+            // 8 bit samples, possibly scattered
+            uint8_t* samples = interlaced ? pass_row : dst;
+
+            if (header.depth < 8)
+               png_expand_low_depth(table, scanline, samples, pass_stride);
+            else if (header.depth == 16)
+               png_expand_16(scanline, samples, pass_stride);
+            else if (interlaced)
+               samples = scanline;
+            else if (!direct)
+               memcpy(dst, scanline, stride);
+
+            if (interlaced)
+            {
+               png_scatter_row(samples, dst, header, pass, pass_w, block_w);
+
+               for (uint32_t k = 1; (k < block_h) && (y + k < header.height); ++k)
+                  memcpy(dst + pitch * (ptrdiff_t)k, dst, stride);
+            }
+
+            if (!direct)
+               std::swap(raw, raw_next);
+
+            prev = scanline;
          }
+
+         if (interlaced && pass_done)
+            pass_done(p + 1);
       }
 
-      wcl::string ihdr_tag(chunks[0]->type, 4);
-      if (ihdr_tag != "IHDR")
+      return WHEEL_OK;
+   }
+
+   /*
+      PNG functions
+   */
+
+   // Indexes the chunks and reads the image header and palette, without decoding anything
+   inline uint32_t png_read_info(const wcl::buffer_t& data, png_chunk_index_t& chunks,
+                                 png_header_t& header, palette_t* palette = nullptr,
+                                 uint32_t flags = 0)
+   {
+      uint32_t result = png_index_chunks(data, chunks, flags);
+
+      if (result != WHEEL_OK)
+         return result;
+
+      if (chunks.empty() || !chunks[0].is("IHDR") || (chunks[0].len < 13))
       {
          log(ERROR, "Malformed PNG file\n");
          return WHEEL_INVALID_FORMAT;
       }
 
-      uint8_t bpp, imgtype, cmethod, filter, interlace;
+      const uint8_t* ihdr = &data[0] + chunks[0].offset;
 
-      chunks[0]->data.seek(0);
-      *w = chunks[0]->data.read_le<uint32_t>();
-      *h = chunks[0]->data.read_le<uint32_t>();
+      header.width       = png_read_u32(ihdr);
+      header.height      = png_read_u32(ihdr + 4);
+      header.depth       = ihdr[8];
+      header.colour_type = ihdr[9];
+      header.interlace   = ihdr[12];
+      header.channels    = 0;
 
-      bpp = chunks[0]->data.read_le<uint8_t>();
-      imgtype = chunks[0]->data.read_le<uint8_t>();
-      cmethod = chunks[0]->data.read_le<uint8_t>();
-      filter = chunks[0]->data.read_le<uint8_t>();
-      interlace = chunks[0]->data.read_le<uint8_t>();
+      const uint8_t cmethod = ihdr[10];
+      const uint8_t filter  = ihdr[11];
+      const uint8_t imgtype = header.colour_type;
+      const uint8_t bpp     = header.depth;
 
       wcl::string type_string;
 
-      if ((bpp < 8) || (cmethod != 0) || (filter != 0))
+      if ((cmethod != 0) || (filter != 0) || (header.width == 0) || (header.height == 0))
       {
          log(ERROR, "Unsupported PNG format\n");
-         for (int i = 0; i < chunks.size(); ++i) delete chunks[i];
          return WHEEL_INVALID_FORMAT;
       }
 
-      if (interlace == 1)
+      if (header.interlace > 1)
       {
-         log(ERROR, "Adam7 interlaced PNG images not supported\n");
-         for (int i = 0; i < chunks.size(); ++i) delete chunks[i];
+         log(ERROR, "Unknown PNG interlace method ", (uint32_t)header.interlace, "\n");
          return WHEEL_INVALID_FORMAT;
       }
 
+      // Bit depths allowed for each colour type
+      uint32_t depths = 0;
+
       if (imgtype == 0)
       {
-         *c = 1;
+         header.channels = 1;
+         depths = 1 | 2 | 4 | 8 | 16;
          type_string = "greyscale";
       } else if (imgtype == 2) {
-         *c = 3;
+         header.channels = 3;
+         depths = 8 | 16;
          type_string = "RGB";
       } else if (imgtype == 3) {
-         *c = 1;
+         header.channels = 1;
+         depths = 1 | 2 | 4 | 8;
          type_string = "indexed";
       } else if (imgtype == 4) {
-         *c = 2;
+         header.channels = 2;
+         depths = 8 | 16;
          type_string = "greyscale-alpha";
       } else if (imgtype == 6) {
-         *c = 4;
+         header.channels = 4;
+         depths = 8 | 16;
          type_string = "RGBA";
       } else {
-         *c = 0;
          type_string = "unrecognized";
       }
 
-      log(FULL_DEBUG, "Reading ",type_string," PNG image: ",*w,"x",*h,", ",
-         (uint32_t)bpp," bits per sample. ", *c," channels\n");
+      log(FULL_DEBUG, "Reading ",type_string," PNG image: ",header.width,"x",header.height,", ",
+         (uint32_t)bpp," bits per sample. ", header.channels," channels\n");
 
-      if (imgtype == 3)
+      if (header.channels == 0)
       {
-         uint32_t plte = ~0;
-         uint32_t trns = ~0;
+         log(ERROR, "Unsupported PNG colour type ", (uint32_t)imgtype, "\n");
+         return WHEEL_INVALID_FORMAT;
+      }
 
-         for (uint32_t it = 0; it < chunks.size(); ++it)
-         {
-            wcl::string s(chunks[it]->type, 4);
-            if (s == "PLTE")
-               plte = it;
-            else if (s == "tRNS")
-               trns = it;
-         }
+      if (((bpp & (bpp - 1)) != 0) || ((depths & bpp) == 0))
+      {
+         log(ERROR, "Invalid bit depth ", (uint32_t)bpp, " for ", type_string, " PNG image\n");
+         return WHEEL_INVALID_FORMAT;
+      }
+
+      if (imgtype == 3)
+      {
+         const png_chunk_t* plte = png_find_chunk(chunks, "PLTE");
+         const png_chunk_t* trns = png_find_chunk(chunks, "tRNS");
 
-         if (plte == ~0)
+         if (plte == nullptr)
          {
-            for (int i = 0; i < chunks.size(); ++i) delete chunks[i];
             log(ERROR, "Indexed image without palette\n");
 
             return WHEEL_INVALID_FORMAT;
          }
 
-         if (chunks[plte]->len % 3 != 0)
+         if (plte->len % 3 != 0)
          {
-            for (int i = 0; i < chunks.size(); ++i) delete chunks[i];
             log(ERROR, "Malformed PLTE chunk in indexed image\n");
 
             return WHEEL_INVALID_FORMAT;
          }
 
-         uint32_t plte_entries = chunks[plte]->len / 3;
+         const uint8_t* entry = &data[0] + plte->offset;
+         const uint8_t* alpha = nullptr;
+
+         uint32_t plte_entries = plte->len / 3;
          uint32_t trns_entries = 0;
 
-         if (trns != ~0)
+         if (trns != nullptr)
          {
-            chunks[trns]->data.seek(0);
-            trns_entries = chunks[plte]->len;
+            alpha = &data[0] + trns->offset;
+            trns_entries = trns->len;
          }
-         uint8_t r,g,b,a;
 
          if (palette != nullptr)
-            palette->clear();
-
-         for (uint32_t i = 0; i < plte_entries; ++i)
          {
-            chunks[plte]->data.seek(3 * i);
-            r = chunks[plte]->data.read<uint8_t>();
-            g = chunks[plte]->data.read<uint8_t>();
-            b = chunks[plte]->data.read<uint8_t>();
-
-            if (i < trns_entries)
-               a = chunks[trns]->data.read<uint8_t>();
-            else
-               a = 0xff;
-
-            // TODO: Do something with the palette entries?
+            palette->clear();
+            palette->reserve(plte_entries);
 
-            if (palette != nullptr)
-               palette->push_back((r << 24) + (g << 16) + (b << 8) + a);
+            for (uint32_t i = 0; i < plte_entries; ++i, entry += 3)
+            {
+               uint8_t a = (i < trns_entries) ? alpha[i] : 0xff;
+               palette->push_back((entry[0] << 24) + (entry[1] << 16) + (entry[2] << 8) + a);
+            }
          }
 
          log(FULL_DEBUG, "Read ", plte_entries, " palette entries\n");
       }
 
-      wcl::buffer_t concat_data, image_data;
-      uint32_t cnum = 0;
+      return WHEEL_OK;
+   }
 
-      for (auto c : chunks)
-      {
-         wcl::string s(c->type, 4);
-         if (s == "IDAT")
-         {
-            cnum++;
-            log(FULL_DEBUG, "Reading IDAT chunk ",cnum,", size: ",c->len, "B\n");
+   /*
+      flags takes IMAGE_BOTTOM_UP to store the rows in GL order, and
+      IMAGE_TRUSTED to skip the chunk CRC checks.
 
-            concat_data.insert(std::end(concat_data), std::begin(c->data), std::end(c->data));
-         }
-      }
+      progress, if given, is called after every pass of an Adam7 interlaced
+      image with target holding a blocky preview of the image so far.
+   */
+   inline uint32_t read_png(const wcl::buffer_t& data, uint32_t* w = nullptr, uint32_t* h = nullptr,
+                     uint32_t* c = nullptr, wcl::buffer_t* target = nullptr,
+                     palette_t* palette = nullptr, uint32_t flags = 0,
+                     const png_progress_t& progress = png_progress_t())
+   {
+      png_chunk_index_t chunks;
+      png_header_t header;
 
-      z_uncompress((const void*)&concat_data[0], concat_data.size(), image_data);
-      log(FULL_DEBUG, "Uncompressed image size: ",image_data.size(), " bytes\n");
+      uint32_t result = png_read_info(data, chunks, header, palette, flags);
 
-      uint8_t scanline_filter, pd;
-      size_t col, decoded_bytes = 0;
-      int32_t left, top, d;
+      if (result != WHEEL_OK)
+         return result;
+
+      if (w != nullptr)
+         *w = header.width;
+      if (h != nullptr)
+         *h = header.height;
+      if (c != nullptr)
+         *c = header.channels;
 
       if (target == nullptr)
       {
@@ -357,78 +788,28 @@ namespace yam
          return WHEEL_ERROR;
       }
 
-      target->clear();
+      const size_t stride = (size_t)header.width * header.channels;
 
-      for (size_t row = 0; row < *h; ++row)
-      {
-         scanline_filter = image_data.read<uint8_t>();
-         col = 0;
+      target->resize(stride * header.height);
 
-         while (col < *w)
-         {
-            if (bpp == 8)
-            {
-               for (size_t ch = 0; ch < *c; ++ch)
-               {
-                  pd = image_data.read<uint8_t>();
+      std::function<void(uint32_t)> pass_done;
 
-                  if (col == 0)
-                     left = 0;
-                  else
-                     left = target->at(target->size() - 1 * *c);
+      if (progress)
+         pass_done = [&](uint32_t pass) { progress(pass, *target); };
 
-                  if (row == 0)
-                     top = 0;
-                  else
-                     top = target->at(target->size() - *c * *w);
+      uint8_t* first_row = &(*target)[0];
+      ptrdiff_t pitch = stride;
 
-                  if (left == 0 && top == 0)
-                     d = 0;
-                  else
-                  {
-                     if (row == 0)
-                        d = 0;
-                     else if (col == 0)
-                        d = left;
-                     else
-                        d = target->at(target->size() - *c * *w - *c);
-                  }
+      if (flags & IMAGE_BOTTOM_UP)
+      {
+         first_row += stride * (header.height - 1);
+         pitch = -pitch;
+      }
 
-                  if (scanline_filter == 0)
-                  {
-                     target->push_back(pd);
-                  } else if (scanline_filter == 1) {
-                     target->push_back(pd + left);
-                  } else if (scanline_filter == 2) {
-                     target->push_back(pd + top);
-                  } else if (scanline_filter == 3) {
-                     target->push_back(pd + ((top + left) >> 1));
-                  } else if (scanline_filter == 4) {
-                     int32_t p = left + top - d;
-                     int32_t pa = abs(p - left);
-                     int32_t pb = abs(p - top);
-                     int32_t pc = abs(p - d);
-                     uint8_t pr;
-
-                     if ((pa <= pb) && (pa <= pc))
-                        pr = left;
-                     else if (pb <= pc)
-                        pr = top;
-                     else
-                        pr = d;
-
-                     target->push_back(pd + pr);
-                  }
-               }
+      result = png_decode_rows(data, chunks, header, first_row, pitch, flags, pass_done);
 
-               decoded_bytes++;
-               col++;
-            } else {
-               log(FATAL, "Unimplemented function: can't decode bpp ",(uint32_t)bpp,"\n");
-               assert(0 && "nope");
-            }
-         }
-      }
+      if (result != WHEEL_OK)
+         return result;
 
       log(FULL_DEBUG, "Read ", target->size(), " bytes of image data into buffer\n");
 
@@ -444,431 +825,401 @@ namespace yam
    }
 
    template<>
-   inline uint32_t load_to_buffer<format::PNG>(image_t& target, const wcl::string& file)
+   inline uint32_t load_to_buffer<format::PNG>(image_t& target, const wcl::string& file, uint32_t flags)
    {
       wcl::buffer_t* png = wcl::GetBuffer(file);
-      read_png(*png, &target.width, &target.height, &target.channels, &target.image);
+
+      if (png == nullptr)
+      {
+         log(ERROR, "Can't open PNG image ", file, "\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      uint32_t result = read_png(*png, &target.width, &target.height, &target.channels, &target.image,
+                                 nullptr, flags);
       wcl::DeleteBuffer(file);
 
-      return WHEEL_UNIMPLEMENTED_FEATURE;
+      return result;
    }
 
+   /*
+      Decodes straight into a mapped pixel unpack buffer, bottom row first,
+      and creates the texture from there.  The image never exists in client
+      memory, and the upload doesn't block.
+   */
    template<>
-   inline uint32_t load_to_texture<format::PNG>(const wcl::string& texture, const wcl::string& file)
+   inline uint32_t load_to_texture<format::PNG>(const wcl::string& texture, const wcl::string& file,
+                                                uint32_t flags)
    {
-      image_t image;
-      load_to_buffer<format::PNG>(image, file);
+      wcl::buffer_t* png = wcl::GetBuffer(file);
 
-      flip_vertical(image);
+      if (png == nullptr)
+      {
+         log(ERROR, "Can't open PNG image ", file, "\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
 
-      renderer.CreateTexture(texture, image);
+      png_chunk_index_t chunks;
+      png_header_t header;
 
-      return WHEEL_UNIMPLEMENTED_FEATURE;
-   }
+      uint32_t result = png_read_info(*png, chunks, header, nullptr, flags);
 
-   inline void png_chunk_to_buffer(PNGChunk& chunk, wcl::buffer_t& buffer)
-   {
-      buffer.seek(buffer.size());
-      buffer.write_le<uint32_t>(chunk.len);
+      if (result == WHEEL_OK)
+      {
+         const size_t stride = (size_t)header.width * header.channels;
+         uint8_t* pixels = renderer.MapPixelBuffer(stride * header.height);
 
-      buffer.write<uint8_t>(chunk.type[0]);
-      buffer.write<uint8_t>(chunk.type[1]);
-      buffer.write<uint8_t>(chunk.type[2]);
-      buffer.write<uint8_t>(chunk.type[3]);
+         if (pixels == nullptr)
+         {
+            result = WHEEL_RESOURCE_UNAVAILABLE;
+         } else {
+            result = png_decode_rows(*png, chunks, header, pixels + stride * (header.height - 1),
+                                     -(ptrdiff_t)stride, PNG_WRITE_ONLY);
 
-      buffer.write(chunk.data);
+            if (result == WHEEL_OK)
+               result = renderer.CreateTextureFromPixelBuffer(texture, header.width, header.height,
+                                                              header.channels);
+            else
+               renderer.DiscardPixelBuffer();
+         }
+      }
 
-      uint32_t crc = 0xffffffff;
-      crc = wcl::update_crc(crc, (uint8_t*)chunk.type, sizeof(uint32_t));
-      crc = wcl::update_crc(crc, (uint8_t*)&(chunk.data[0]), chunk.len);
-      crc ^= 0xffffffff;
+      wcl::DeleteBuffer(file);
 
-      buffer.write_le<uint32_t>(crc);
+      return result;
    }
 
-   inline void png_chunk_write_type(PNGChunk& chunk, const wcl::string& name)
+   /*
+      Like load_to_texture<format::PNG>, but an interlaced image gets
+      uploaded after every Adam7 pass, so the texture shows a low resolution
+      version of the image while the rest of it is being decoded.
+   */
+   inline uint32_t load_to_texture_progressive(const wcl::string& texture, const wcl::string& file)
    {
-      if (name.length() < 4)
+      wcl::buffer_t* png = wcl::GetBuffer(file);
+
+      if (png == nullptr)
       {
-         log(WARNING, "Tried to assign invalid PNG chunk name\n");
-         return;
+         log(ERROR, "Can't open PNG image ", file, "\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
       }
 
-      std::string r = name.std_str();
+      image_t image;
+      bool created = false;
 
-      chunk.type[0] = r[0];
-      chunk.type[1] = r[1];
-      chunk.type[2] = r[2];
-      chunk.type[3] = r[3];
-   }
+      auto upload = [&](uint32_t pass, const wcl::buffer_t& pixels)
+      {
+         // The last pass completes the image, which is uploaded below
+         if (pass == 7)
+            return;
 
-   template<typename... Args>
-   uint32_t save_png(const wcl::string& filename, const image_t& src, Args... chunks)
-   {
-      if (src.width < 1 || src.height < 1)
+         if (!created)
+         {
+            renderer.CreateTexture(texture, image.width, image.height, image.channels);
+            created = true;
+         }
+
+         renderer.UploadTextureData(texture, 0, 0, image.width, image.height, (void*)&pixels[0]);
+      };
+
+      uint32_t result = read_png(*png, &image.width, &image.height, &image.channels,
+                                 &image.image, nullptr, IMAGE_BOTTOM_UP, upload);
+      wcl::DeleteBuffer(file);
+
+      if (result != WHEEL_OK)
       {
-         log(WARNING, "Ignored file write request of image with 0 size\n");
-         return WHEEL_INVALID_VALUE;
+         if (created)
+            renderer.DeleteTexture(texture);
+
+         return result;
       }
 
-      wcl::buffer_t output;
-      output.clear();
-      // PNG file header
-      output.write_bytes(137, 80, 78, 71, 13, 10, 26, 10);
+      if (created)
+         renderer.UploadTextureData(texture, image);
+      else
+         renderer.CreateTexture(texture, image);
 
-      PNGChunk chunk;
+      return WHEEL_OK;
+   }
 
-      png_chunk_write_type(chunk, "IHDR");
-      chunk.data.write_le<uint32_t>(src.width);
-      chunk.data.write_le<uint32_t>(src.height);
-      chunk.data.write_bytes(8, 6, 0, 0, 0);
-      chunk.len = chunk.data.size();
 
-      // IHDR chunk
-      png_chunk_to_buffer(chunk, output);
-      chunk.data.clear();
+   /*
+      PNG encoder
 
-      // IDAT chunks
-      png_chunk_write_type(chunk, "IDAT");
-      wcl::buffer_t unpacked_data;
-      unpacked_data.reserve(src.width * src.height * 4);
+      Levels are zlib compression levels: PNG_LEVEL_FASTEST is for capture
+      paths that care about latency, PNG_LEVEL_SMALLEST for baked assets.
+   */
+   constexpr int PNG_LEVEL_STORE    = 0;
+   constexpr int PNG_LEVEL_FASTEST  = 1;
+   constexpr int PNG_LEVEL_DEFAULT  = 6;
+   constexpr int PNG_LEVEL_SMALLEST = 9;
 
-      for (size_t j = 0; j < src.height; ++j)
-      {
-         unpacked_data.write<uint8_t>(0);
-         for (size_t i = 0; i < src.width; ++i)
-         {
-            if (src.channels == 1)
-            {
-//               unpacked_data.push_back()
-            } else if (src.channels == 4)
-            {
+   // Smallest amount of raw image data worth a thread of its own
+   constexpr size_t PNG_BAND_SIZE = ZLIB_CHUNK;
 
-            }
-         }
-      }
-      chunk.data.clear();
+   inline void png_write_u32(wcl::buffer_t& buffer, uint32_t value)
+   {
+      buffer.push_back(value >> 24);
+      buffer.push_back(value >> 16);
+      buffer.push_back(value >> 8);
+      buffer.push_back(value);
+   }
 
-      png_chunk_write_type(chunk, "IEND");
-      chunk.data.clear();
-      png_chunk_to_buffer(chunk, output);
+   inline void png_write_chunk(wcl::buffer_t& buffer, const char* type, const uint8_t* data, size_t len)
+   {
+      png_write_u32(buffer, len);
 
-      // IEND chunk
-      for (uint8_t c : output)
-      {
-         std::cout << (uint32_t)c << ", " << c << "\n";
-      }
+      size_t start = buffer.size();
 
-      return 0;
-      // saVe
-/*
-      inline uint32_t read_png(const wcl::buffer_t& data, uint32_t* w = nullptr, uint32_t* h = nullptr,
-                        uint32_t* c = nullptr, wcl::buffer_t* target = nullptr,
-                        palette_t* palette = nullptr)
-      {
-         uint32_t nw, nh, nc;
-         if (w == nullptr)
-            w = &nw;
-         if (h == nullptr)
-            h = &nh;
-         if (c == nullptr)
-            c = &nc;
+      buffer.insert(buffer.end(), type, type + 4);
+      buffer.insert(buffer.end(), data, data + len);
 
-         std::vector<PNGChunk*> chunks;
+      uint32_t crc = 0xffffffff;
+      crc = update_crc32(crc, &buffer[start], len + 4);
+      crc ^= 0xffffffff;
 
-         wcl::buffer_t& buffer = (wcl::buffer_t&)data;
-         buffer.seek(8);
+      png_write_u32(buffer, crc);
+   }
 
-         while(buffer.pos() < buffer.size())
-         {
-            PNGChunk* next = new PNGChunk;
+   // Adler-32 of two blocks of data put together, len2 being the size of the second one
+   inline uint32_t png_adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2)
+   {
+      const uint32_t base = 65521;
 
-            if (!buffer.can_read(sizeof(next->len)))
-            {
-               delete next;
-               log(ERROR, "Abrupt end of memory buffer: can't read PNG chunk length\n");
-               return WHEEL_UNEXPECTED_END_OF_FILE;
-            }
+      uint32_t rem = len2 % base;
+      uint32_t sum1 = adler1 & 0xffff;
+      uint32_t sum2 = (rem * sum1) % base;
 
-            next->len = buffer.read_le<uint32_t>();
+      sum1 += (adler2 & 0xffff) + base - 1;
+      sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
 
-            if (!buffer.can_read(sizeof(next->type)))
-            {
-               delete next;
-               log(ERROR, "Abrupt end of memory buffer: can't read PNG chunk type\n");
-            }
+      if (sum1 >= base)
+         sum1 -= base;
+      if (sum1 >= base)
+         sum1 -= base;
+      if (sum2 >= (base << 1))
+         sum2 -= (base << 1);
+      if (sum2 >= base)
+         sum2 -= base;
 
-            strncpy(next->type, (const char*)(&buffer[0] + buffer.pos()), 4);
-            wcl::string s(next->type, 4);
-            buffer.seek(buffer.pos() + 4);
+      return sum1 | (sum2 << 16);
+   }
 
-            if (!buffer.can_read(next->len))
-            {
-               delete next;
-               log(ERROR, "Abrupt end of memory buffer: can't read PNG chunk data\n");
-               return WHEEL_UNEXPECTED_END_OF_FILE;
-            }
+   // One horizontal slice of the image, filtered and deflated on its own
+   struct png_band_t
+   {
+      uint32_t       first_row;
+      uint32_t       rows;
+
+      bool           last;
+      uint32_t       adler;
+      size_t         raw_size;
+      wcl::buffer_t  deflated;
+      bool           ok;
+   };
 
-            // TODO: Double-check this.
-            next->data.resize(next->len);
-            memcpy(&(next->data[0]), (&buffer[0] + buffer.pos()), next->len);
-            buffer.seek(buffer.pos() + next->len);
+   /*
+      Filters the rows of a band and deflates them into a raw deflate
+      stream.  Every band but the last ends with a sync flush, so it stops
+      on a byte boundary and the streams of all bands can simply be joined.
+   */
+   inline void png_encode_band(const image_t& src, png_band_t& band, int level)
+   {
+      const size_t stride = (size_t)src.width * src.channels;
+      const uint8_t last_filter = (level <= PNG_LEVEL_FASTEST) ? PNG_FILTER_UP : PNG_FILTER_PAETH;
 
-            if (!buffer.can_read(sizeof(next->crc)))
-            {
-               delete next;
-               log(ERROR, "Abrupt end of memory buffer: can't read PNG chunk crc\n");
-               return WHEEL_UNEXPECTED_END_OF_FILE;
-            }
+      wcl::buffer_t filtered, scratch;
+      filtered.resize((stride + 1) * band.rows);
+      scratch.resize(2 * stride);
 
-            next->crc = buffer.read_le<uint32_t>();
-            uint32_t crc_check = 0xffffffff;
-            crc_check = wcl::update_crc(crc_check, (uint8_t*)next->type, sizeof(uint32_t));
-            crc_check = wcl::update_crc(crc_check, (uint8_t*)&(next->data[0]), next->len);
-            crc_check ^= 0xffffffff;
+      // The row above the top of the image is all zeroes
+      wcl::buffer_t zero_row;
+      zero_row.resize(stride);
 
-            if (next->crc == crc_check)
-            {
-               chunks.push_back(next);
-               if (s == "IEND")
-                  break;
-            } else {
-               log(WARNING, "Ignored PNG chunk: ", s, ", failed CRC check\n");
-               delete next;
-            }
-         }
+      for (uint32_t row = 0; row < band.rows; ++row)
+      {
+         const uint32_t y = band.first_row + row;
+         const uint8_t* line = &src.image[stride * y];
+         const uint8_t* prev = y ? line - stride : &zero_row[0];
+         uint8_t* out = &filtered[(stride + 1) * row];
 
-         wcl::string ihdr_tag(chunks[0]->type, 4);
-         if (ihdr_tag != "IHDR")
+         if (level == PNG_LEVEL_STORE)
          {
-            log(ERROR, "Malformed PNG file\n");
-            return WHEEL_INVALID_FORMAT;
+            out[0] = PNG_FILTER_NONE;
+            memcpy(out + 1, line, stride);
+         } else {
+            out[0] = png_filter_row_adaptive(out + 1, &scratch[0], line, prev, stride, src.channels, last_filter);
          }
+      }
 
-         uint8_t bpp, imgtype, cmethod, filter, interlace;
+      band.raw_size = filtered.size();
+      band.adler = mz_adler32(MZ_ADLER32_INIT, &filtered[0], filtered.size());
 
-         chunks[0]->data.seek(0);
-         *w = chunks[0]->data.read_le<uint32_t>();
-         *h = chunks[0]->data.read_le<uint32_t>();
+      z_stream stream;
 
-         bpp = chunks[0]->data.read_le<uint8_t>();
-         imgtype = chunks[0]->data.read_le<uint8_t>();
-         cmethod = chunks[0]->data.read_le<uint8_t>();
-         filter = chunks[0]->data.read_le<uint8_t>();
-         interlace = chunks[0]->data.read_le<uint8_t>();
+      stream.zalloc = Z_NULL;
+      stream.zfree = Z_NULL;
+      stream.opaque = Z_NULL;
 
-         wcl::string type_string;
+      band.ok = false;
 
-         if ((bpp < 8) || (cmethod != 0) || (filter != 0))
-         {
-            log(ERROR, "Unsupported PNG format\n");
-            for (int i = 0; i < chunks.size(); ++i) delete chunks[i];
-            return WHEEL_INVALID_FORMAT;
-         }
+      if (deflateInit2(&stream, level, Z_DEFLATED, -MZ_DEFAULT_WINDOW_BITS, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+         return;
 
-         if (interlace == 1)
-         {
-            log(ERROR, "Adam7 interlaced PNG images not supported\n");
-            for (int i = 0; i < chunks.size(); ++i) delete chunks[i];
-            return WHEEL_INVALID_FORMAT;
-         }
+      // The bound doesn't count the empty block of a sync flush
+      band.deflated.resize(deflateBound(&stream, filtered.size()) + 16);
 
-         if (imgtype == 0)
-         {
-            *c = 1;
-            type_string = "greyscale";
-         } else if (imgtype == 2) {
-            *c = 3;
-            type_string = "RGB";
-         } else if (imgtype == 3) {
-            *c = 1;
-            type_string = "indexed";
-         } else if (imgtype == 4) {
-            *c = 2;
-            type_string = "greyscale-alpha";
-         } else if (imgtype == 6) {
-            *c = 4;
-            type_string = "RGBA";
-         } else {
-            *c = 0;
-            type_string = "unrecognized";
-         }
+      stream.next_in = &filtered[0];
+      stream.avail_in = filtered.size();
+      stream.next_out = &band.deflated[0];
+      stream.avail_out = band.deflated.size();
 
-         log(FULL_DEBUG, "Reading ",type_string," PNG image: ",*w,"x",*h,", ",
-            (uint32_t)bpp," bits per sample. ", *c," channels\n");
+      int result = deflate(&stream, band.last ? Z_FINISH : Z_SYNC_FLUSH);
 
-         if (imgtype == 3)
-         {
-            uint32_t plte = ~0;
-            uint32_t trns = ~0;
+      band.ok = band.last ? (result == Z_STREAM_END) : ((result == Z_OK) && (stream.avail_in == 0));
+      band.deflated.resize(band.deflated.size() - stream.avail_out);
 
-            for (uint32_t it = 0; it < chunks.size(); ++it)
-            {
-               wcl::string s(chunks[it]->type, 4);
-               if (s == "PLTE")
-                  plte = it;
-               else if (s == "tRNS")
-                  trns = it;
-            }
+      deflateEnd(&stream);
+   }
 
-            if (plte == ~0)
-            {
-               for (int i = 0; i < chunks.size(); ++i) delete chunks[i];
-               log(ERROR, "Indexed image without palette\n");
+   /*
+      Encodes an 8 bit image with 1-4 channels into a PNG file in memory.
 
-               return WHEEL_INVALID_FORMAT;
-            }
+      Every row gets the filter that makes its bytes smallest.  The image
+      is cut into bands of rows that are deflated on separate threads and
+      joined with sync flush boundaries into a single zlib stream, like
+      pigz does.  Each band becomes one IDAT chunk.  threads limits the
+      number of bands, 0 uses every core.
+   */
+   inline uint32_t encode_png(const image_t& src, wcl::buffer_t& output, int level = PNG_LEVEL_DEFAULT,
+                              uint32_t threads = 0)
+   {
+      if (src.width < 1 || src.height < 1)
+      {
+         log(WARNING, "Ignored encode request of image with 0 size\n");
+         return WHEEL_INVALID_VALUE;
+      }
 
-            if (chunks[plte]->len % 3 != 0)
-            {
-               for (int i = 0; i < chunks.size(); ++i) delete chunks[i];
-               log(ERROR, "Malformed PLTE chunk in indexed image\n");
+      static const uint8_t colour_types[] = { 0, 0, 4, 2, 6 };
 
-               return WHEEL_INVALID_FORMAT;
-            }
+      if ((src.channels < 1) || (src.channels > 4)
+      || (src.image.size() < (size_t)src.width * src.height * src.channels))
+      {
+         log(ERROR, "Can't encode image with ", src.channels, " channels as PNG\n");
+         return WHEEL_INVALID_VALUE;
+      }
 
-            uint32_t plte_entries = chunks[plte]->len / 3;
-            uint32_t trns_entries = 0;
+      level = std::max(PNG_LEVEL_STORE, std::min(level, PNG_LEVEL_SMALLEST));
 
-            if (trns != ~0)
-            {
-               chunks[trns]->data.seek(0);
-               trns_entries = chunks[plte]->len;
-            }
-            uint8_t r,g,b,a;
+      const size_t stride = (size_t)src.width * src.channels;
 
-            if (palette != nullptr)
-               palette->clear();
+      if (threads == 0)
+         threads = std::max(1u, std::thread::hardware_concurrency());
+      uint32_t band_count = std::min<size_t>(threads, ((stride + 1) * src.height) / PNG_BAND_SIZE);
+      band_count = std::max(1u, std::min(band_count, src.height));
 
-            for (uint32_t i = 0; i < plte_entries; ++i)
-            {
-               chunks[plte]->data.seek(3 * i);
-               r = chunks[plte]->data.read<uint8_t>();
-               g = chunks[plte]->data.read<uint8_t>();
-               b = chunks[plte]->data.read<uint8_t>();
+      std::vector<png_band_t> bands(band_count);
 
-               if (i < trns_entries)
-                  a = chunks[trns]->data.read<uint8_t>();
-               else
-                  a = 0xff;
+      for (uint32_t i = 0; i < band_count; ++i)
+      {
+         bands[i].first_row = (uint64_t)src.height * i / band_count;
+         bands[i].rows = (uint64_t)src.height * (i + 1) / band_count - bands[i].first_row;
+         bands[i].last = (i == band_count - 1);
+      }
 
-               // TODO: Do something with the palette entries?
+      std::vector<std::thread> workers;
 
-               if (palette != nullptr)
-                  palette->push_back((r << 24) + (g << 16) + (b << 8) + a);
-            }
+      for (uint32_t i = 1; i < band_count; ++i)
+         workers.emplace_back(png_encode_band, std::cref(src), std::ref(bands[i]), level);
 
-            log(FULL_DEBUG, "Read ", plte_entries, " palette entries\n");
-         }
+      png_encode_band(src, bands[0], level);
 
-         wcl::buffer_t concat_data, image_data;
-         uint32_t cnum = 0;
+      for (auto& worker : workers)
+         worker.join();
 
-         for (auto c : chunks)
-         {
-            wcl::string s(c->type, 4);
-            if (s == "IDAT")
-            {
-               cnum++;
-               log(FULL_DEBUG, "Reading IDAT chunk ",cnum,", size: ",c->len, "B\n");
+      output.clear();
 
-               concat_data.insert(std::end(concat_data), std::begin(c->data), std::end(c->data));
-            }
-         }
+      // PNG file header
+      const uint8_t signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+      output.insert(output.end(), signature, signature + 8);
 
-         z_uncompress((const void*)&concat_data[0], concat_data.size(), image_data);
-         log(FULL_DEBUG, "Uncompressed image size: ",image_data.size(), " bytes\n");
+      wcl::buffer_t ihdr;
+      png_write_u32(ihdr, src.width);
+      png_write_u32(ihdr, src.height);
+      ihdr.push_back(8);
+      ihdr.push_back(colour_types[src.channels]);
+      ihdr.push_back(0);
+      ihdr.push_back(0);
+      ihdr.push_back(0);
 
-         uint8_t scanline_filter, pd;
-         size_t col, decoded_bytes = 0;
-         int32_t left, top, d;
+      png_write_chunk(output, "IHDR", &ihdr[0], ihdr.size());
 
-         if (target == nullptr)
+      // zlib header with the level hint, followed by the bands
+      uint8_t flevel = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+      uint8_t zlib_header[] = { 0x78, (uint8_t)(flevel << 6) };
+      zlib_header[1] += 31 - ((zlib_header[0] << 8) | zlib_header[1]) % 31;
+
+      uint32_t adler = MZ_ADLER32_INIT;
+      wcl::buffer_t idat;
+
+      for (uint32_t i = 0; i < band_count; ++i)
+      {
+         if (!bands[i].ok)
          {
-            log(FULL_DEBUG, "targeting nullptr buffer, bailing out\n");
+            log(ERROR, "zlib error: deflate failed\n");
             return WHEEL_ERROR;
          }
 
-         target->clear();
+         adler = png_adler32_combine(adler, bands[i].adler, bands[i].raw_size);
 
-         for (size_t row = 0; row < *h; ++row)
-         {
-            scanline_filter = image_data.read<uint8_t>();
-            col = 0;
+         idat.clear();
 
-            while (col < *w)
-            {
-               if (bpp == 8)
-               {
-                  for (size_t ch = 0; ch < *c; ++ch)
-                  {
-                     pd = image_data.read<uint8_t>();
-
-                     if (col == 0)
-                        left = 0;
-                     else
-                        left = target->at(target->size() - 1 * *c);
-
-                     if (row == 0)
-                        top = 0;
-                     else
-                        top = target->at(target->size() - *c * *w);
-
-                     if (left == 0 && top == 0)
-                        d = 0;
-                     else
-                     {
-                        if (row == 0)
-                           d = 0;
-                        else if (col == 0)
-                           d = left;
-                        else
-                           d = target->at(target->size() - *c * *w - *c);
-                     }
-
-                     if (scanline_filter == 0)
-                     {
-                        target->push_back(pd);
-                     } else if (scanline_filter == 1) {
-                        target->push_back(pd + left);
-                     } else if (scanline_filter == 2) {
-                        target->push_back(pd + top);
-                     } else if (scanline_filter == 3) {
-                        target->push_back(pd + ((top + left) >> 1));
-                     } else if (scanline_filter == 4) {
-                        int32_t p = left + top - d;
-                        int32_t pa = abs(p - left);
-                        int32_t pb = abs(p - top);
-                        int32_t pc = abs(p - d);
-                        uint8_t pr;
-
-                        if ((pa <= pb) && (pa <= pc))
-                           pr = left;
-                        else if (pb <= pc)
-                           pr = top;
-                        else
-                           pr = d;
-
-                        target->push_back(pd + pr);
-                     }
-                  }
+         if (i == 0)
+            idat.insert(idat.end(), zlib_header, zlib_header + 2);
 
-                  decoded_bytes++;
-                  col++;
-               } else {
-                  log(FATAL, "Unimplemented function: can't decode bpp ",(uint32_t)bpp,"\n");
-                  assert(0 && "nope");
-               }
-            }
-         }
+         idat.insert(idat.end(), bands[i].deflated.begin(), bands[i].deflated.end());
 
-         log(FULL_DEBUG, "Read ", target->size(), " bytes of image data into buffer\n");
+         if (bands[i].last)
+            png_write_u32(idat, adler);
 
-         return WHEEL_OK;
+         png_write_chunk(output, "IDAT", &idat[0], idat.size());
       }
 
+      png_write_chunk(output, "IEND", nullptr, 0);
+
+      return WHEEL_OK;
+   }
+
+   inline uint32_t save_png(const wcl::string& filename, const image_t& src, int level = PNG_LEVEL_DEFAULT,
+                            uint32_t threads = 0)
+   {
+      wcl::buffer_t output;
+
+      uint32_t result = encode_png(src, output, level, threads);
+
+      if (result != WHEEL_OK)
+         return result;
+
+      FILE* file = fopen(filename.std_str().c_str(), "wb");
+
+      if (file == nullptr)
+      {
+         log(ERROR, "Can't open ", filename, " for writing\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      size_t written = fwrite(&output[0], 1, output.size(), file);
+      fclose(file);
+
+      if (written != output.size())
+      {
+         log(ERROR, "Failed to write ", filename, "\n");
+         return WHEEL_ERROR;
+      }
+
+      log(FULL_DEBUG, "Wrote ", output.size(), " bytes of PNG image to ", filename, "\n");
+
       return WHEEL_OK;
-*/
    }
 }
 #endif
@@ -0,0 +1,368 @@
+#ifndef YAM_PNG_FILTER_HPP
+#define YAM_PNG_FILTER_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <utility>
+
+#if defined(__SSE2__)
+   #include <emmintrin.h>
+#endif
+
+/*
+   PNG scanline reconstruction, and filtering for the encoder.
+
+   All kernels work on one whole scanline at a time:
+      out  - reconstructed bytes are written here
+      in   - filtered bytes of the scanline (without the filter type byte),
+             may be the same pointer as out
+      prev - reconstructed previous scanline, all zeroes for the first row
+      len  - bytes in the scanline
+      bpp  - bytes per complete pixel, rounded up to 1
+*/
+
+namespace yam
+{
+   constexpr uint8_t PNG_FILTER_NONE    = 0;
+   constexpr uint8_t PNG_FILTER_SUB     = 1;
+   constexpr uint8_t PNG_FILTER_UP      = 2;
+   constexpr uint8_t PNG_FILTER_AVERAGE = 3;
+   constexpr uint8_t PNG_FILTER_PAETH   = 4;
+
+   inline uint8_t png_paeth_predictor(int32_t a, int32_t b, int32_t c)
+   {
+      int32_t pa = abs(b - c);
+      int32_t pb = abs(a - c);
+      int32_t pc = abs(a + b - 2 * c);
+
+      if ((pa <= pb) && (pa <= pc))
+         return a;
+      else if (pb <= pc)
+         return b;
+
+      return c;
+   }
+
+   inline void png_unfilter_sub_scalar(uint8_t* out, const uint8_t* in, size_t len, size_t bpp, size_t start = 0)
+   {
+      size_t i = start;
+
+      for (; i < bpp && i < len; ++i)
+         out[i] = in[i];
+
+      for (; i < len; ++i)
+         out[i] = in[i] + out[i - bpp];
+   }
+
+   inline void png_unfilter_up_scalar(uint8_t* out, const uint8_t* in, const uint8_t* prev,
+                                      size_t len, size_t start = 0)
+   {
+      for (size_t i = start; i < len; ++i)
+         out[i] = in[i] + prev[i];
+   }
+
+   inline void png_unfilter_average_scalar(uint8_t* out, const uint8_t* in, const uint8_t* prev,
+                                           size_t len, size_t bpp)
+   {
+      size_t i = 0;
+
+      for (; i < bpp && i < len; ++i)
+         out[i] = in[i] + (prev[i] >> 1);
+
+      for (; i < len; ++i)
+         out[i] = in[i] + ((out[i - bpp] + prev[i]) >> 1);
+   }
+
+   inline void png_unfilter_paeth_scalar(uint8_t* out, const uint8_t* in, const uint8_t* prev,
+                                         size_t len, size_t bpp)
+   {
+      size_t i = 0;
+
+      // With no left neighbour the predictor always picks the byte above
+      for (; i < bpp && i < len; ++i)
+         out[i] = in[i] + prev[i];
+
+      for (; i < len; ++i)
+         out[i] = in[i] + png_paeth_predictor(out[i - bpp], prev[i], prev[i - bpp]);
+   }
+
+#if defined(__SSE2__)
+   inline __m128i png_load_pixel(const uint8_t* p, size_t bpp)
+   {
+      uint32_t v = 0;
+      memcpy(&v, p, bpp);
+      return _mm_cvtsi32_si128(v);
+   }
+
+   inline void png_store_pixel(uint8_t* p, __m128i x, size_t bpp)
+   {
+      uint32_t v = _mm_cvtsi128_si32(x);
+      memcpy(p, &v, bpp);
+   }
+
+   // Prefix sum of 16 bytes in steps of BPP, so each lane gets every lane to its left added in
+   template<int BPP>
+   inline void png_unfilter_sub_sse2(uint8_t* out, const uint8_t* in, size_t len)
+   {
+      __m128i carry = _mm_setzero_si128();
+      size_t i = 0;
+
+      for (; i + 16 <= len; i += 16)
+      {
+         __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+
+         x = _mm_add_epi8(x, _mm_slli_si128(x, BPP));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 2 * BPP));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 4 * BPP));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 8 * BPP));
+         x = _mm_add_epi8(x, carry);
+
+         _mm_storeu_si128((__m128i*)(out + i), x);
+
+         if (BPP == 1)
+            carry = _mm_set1_epi8(out[i + 15]);
+         else if (BPP == 2)
+            carry = _mm_shuffle_epi32(_mm_shufflehi_epi16(x, 0xff), 0xff);
+         else
+            carry = _mm_shuffle_epi32(x, 0xff);
+      }
+
+      png_unfilter_sub_scalar(out, in, len, BPP, i);
+   }
+
+   inline void png_unfilter_sub_pixel_sse2(uint8_t* out, const uint8_t* in, size_t len, size_t bpp)
+   {
+      __m128i a = _mm_setzero_si128();
+
+      for (size_t i = 0; i < len; i += bpp)
+      {
+         a = _mm_add_epi8(a, png_load_pixel(in + i, bpp));
+         png_store_pixel(out + i, a, bpp);
+      }
+   }
+
+   inline void png_unfilter_up_sse2(uint8_t* out, const uint8_t* in, const uint8_t* prev, size_t len)
+   {
+      size_t i = 0;
+
+      for (; i + 16 <= len; i += 16)
+      {
+         __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+         __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+
+         _mm_storeu_si128((__m128i*)(out + i), _mm_add_epi8(x, b));
+      }
+
+      png_unfilter_up_scalar(out, in, prev, len, i);
+   }
+
+   inline void png_unfilter_average_sse2(uint8_t* out, const uint8_t* in, const uint8_t* prev,
+                                         size_t len, size_t bpp)
+   {
+      const __m128i one = _mm_set1_epi8(1);
+      __m128i a = _mm_setzero_si128();
+
+      for (size_t i = 0; i < len; i += bpp)
+      {
+         __m128i b = png_load_pixel(prev + i, bpp);
+         __m128i x = png_load_pixel(in + i, bpp);
+
+         // _mm_avg_epu8 rounds up, PNG rounds down
+         __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+
+         a = _mm_add_epi8(x, avg);
+         png_store_pixel(out + i, a, bpp);
+      }
+   }
+
+   inline __m128i png_abs_epi16(__m128i x)
+   {
+      return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+   }
+
+   inline __m128i png_select(__m128i mask, __m128i a, __m128i b)
+   {
+      return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+   }
+
+   inline void png_unfilter_paeth_sse2(uint8_t* out, const uint8_t* in, const uint8_t* prev,
+                                       size_t len, size_t bpp)
+   {
+      const __m128i zero = _mm_setzero_si128();
+      __m128i a = zero, c = zero;
+
+      for (size_t i = 0; i < len; i += bpp)
+      {
+         __m128i b = _mm_unpacklo_epi8(png_load_pixel(prev + i, bpp), zero);
+         __m128i x = png_load_pixel(in + i, bpp);
+
+         __m128i pa = _mm_sub_epi16(b, c);
+         __m128i pb = _mm_sub_epi16(a, c);
+         __m128i pc = _mm_add_epi16(pa, pb);
+
+         pa = png_abs_epi16(pa);
+         pb = png_abs_epi16(pb);
+         pc = png_abs_epi16(pc);
+
+         __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+         __m128i nearest = png_select(_mm_cmpeq_epi16(smallest, pa), a,
+                           png_select(_mm_cmpeq_epi16(smallest, pb), b, c));
+
+         x = _mm_add_epi8(x, _mm_packus_epi16(nearest, nearest));
+         png_store_pixel(out + i, x, bpp);
+
+         a = _mm_unpacklo_epi8(x, zero);
+         c = b;
+      }
+   }
+#endif
+
+   inline void png_unfilter_sub(uint8_t* out, const uint8_t* in, size_t len, size_t bpp)
+   {
+#if defined(__SSE2__)
+      if (bpp == 1)
+         return png_unfilter_sub_sse2<1>(out, in, len);
+      else if (bpp == 2)
+         return png_unfilter_sub_sse2<2>(out, in, len);
+      else if (bpp == 4)
+         return png_unfilter_sub_sse2<4>(out, in, len);
+      else if (bpp == 3)
+         return png_unfilter_sub_pixel_sse2(out, in, len, bpp);
+#endif
+      png_unfilter_sub_scalar(out, in, len, bpp);
+   }
+
+   inline void png_unfilter_up(uint8_t* out, const uint8_t* in, const uint8_t* prev, size_t len)
+   {
+#if defined(__SSE2__)
+      return png_unfilter_up_sse2(out, in, prev, len);
+#endif
+      png_unfilter_up_scalar(out, in, prev, len);
+   }
+
+   inline void png_unfilter_average(uint8_t* out, const uint8_t* in, const uint8_t* prev,
+                                    size_t len, size_t bpp)
+   {
+#if defined(__SSE2__)
+      if (bpp == 3 || bpp == 4)
+         return png_unfilter_average_sse2(out, in, prev, len, bpp);
+#endif
+      png_unfilter_average_scalar(out, in, prev, len, bpp);
+   }
+
+   inline void png_unfilter_paeth(uint8_t* out, const uint8_t* in, const uint8_t* prev,
+                                  size_t len, size_t bpp)
+   {
+#if defined(__SSE2__)
+      if (bpp == 3 || bpp == 4)
+         return png_unfilter_paeth_sse2(out, in, prev, len, bpp);
+#endif
+      png_unfilter_paeth_scalar(out, in, prev, len, bpp);
+   }
+
+   // Returns false on an unknown filter type
+   inline bool png_unfilter_row(uint8_t filter, uint8_t* out, const uint8_t* in, const uint8_t* prev,
+                                size_t len, size_t bpp)
+   {
+      if (filter == PNG_FILTER_NONE)
+      {
+         if (out != in)
+            memcpy(out, in, len);
+      } else if (filter == PNG_FILTER_SUB) {
+         png_unfilter_sub(out, in, len, bpp);
+      } else if (filter == PNG_FILTER_UP) {
+         png_unfilter_up(out, in, prev, len);
+      } else if (filter == PNG_FILTER_AVERAGE) {
+         png_unfilter_average(out, in, prev, len, bpp);
+      } else if (filter == PNG_FILTER_PAETH) {
+         png_unfilter_paeth(out, in, prev, len, bpp);
+      } else {
+         return false;
+      }
+
+      return true;
+   }
+
+   /*
+      Encoder side: filters one scanline with the given filter type and
+      returns the sum of the absolute values of the filtered bytes, taken as
+      signed.  That sum is the usual heuristic for how well a row will
+      deflate, the smaller the better.
+   */
+   inline uint32_t png_filter_row(uint8_t filter, uint8_t* out, const uint8_t* row, const uint8_t* prev,
+                                  size_t len, size_t bpp)
+   {
+      size_t i = 0;
+
+      if (filter == PNG_FILTER_NONE)
+      {
+         memcpy(out, row, len);
+      } else if (filter == PNG_FILTER_SUB) {
+         for (; i < bpp && i < len; ++i)
+            out[i] = row[i];
+
+         for (; i < len; ++i)
+            out[i] = row[i] - row[i - bpp];
+      } else if (filter == PNG_FILTER_UP) {
+         for (; i < len; ++i)
+            out[i] = row[i] - prev[i];
+      } else if (filter == PNG_FILTER_AVERAGE) {
+         for (; i < bpp && i < len; ++i)
+            out[i] = row[i] - (prev[i] >> 1);
+
+         for (; i < len; ++i)
+            out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+      } else {
+         for (; i < bpp && i < len; ++i)
+            out[i] = row[i] - prev[i];
+
+         for (; i < len; ++i)
+            out[i] = row[i] - png_paeth_predictor(row[i - bpp], prev[i], prev[i - bpp]);
+      }
+
+      uint32_t sum = 0;
+
+      for (i = 0; i < len; ++i)
+         sum += abs((int8_t)out[i]);
+
+      return sum;
+   }
+
+   /*
+      Filters a scanline with every filter type up to last_filter and keeps
+      the one with the smallest sum.  scratch has to hold two scanlines.
+      Returns the chosen filter type, the filtered bytes end up in out.
+   */
+   inline uint8_t png_filter_row_adaptive(uint8_t* out, uint8_t* scratch, const uint8_t* row,
+                                          const uint8_t* prev, size_t len, size_t bpp,
+                                          uint8_t last_filter = PNG_FILTER_PAETH)
+   {
+      uint8_t best = PNG_FILTER_NONE;
+      uint32_t best_sum = png_filter_row(PNG_FILTER_NONE, out, row, prev, len, bpp);
+
+      uint8_t* candidate = scratch;
+      uint8_t* spare = scratch + len;
+
+      for (uint8_t filter = PNG_FILTER_SUB; filter <= last_filter; ++filter)
+      {
+         uint32_t sum = png_filter_row(filter, candidate, row, prev, len, bpp);
+
+         if (sum < best_sum)
+         {
+            best = filter;
+            best_sum = sum;
+            std::swap(candidate, spare);
+         }
+      }
+
+      // The best candidate is the one last swapped out into spare
+      if (best != PNG_FILTER_NONE)
+         memcpy(out, spare, len);
+
+      return best;
+   }
+}
+
+#endif
@@ -0,0 +1,418 @@
+#ifndef YAM_YTX_HPP
+#define YAM_YTX_HPP
+
+#include <wheel.h>
+#include <cstdio>
+
+#include "../image.h"
+#include "../renderer.h"
+#include "../mapped_file.h"
+#include "../pixelops.h"
+#include "bcn.hpp"
+
+/*
+   yam texture container (.ytx)
+
+   Pixels are stored the way glTexImage2D takes them: bottom row first,
+   every mip level already built, and the GL formats in the header.
+   Loading one maps the file and passes pointers into the mapping to the
+   upload, nothing gets decoded, converted or copied on the way.
+
+   The levels may be block compressed (see bcn.hpp), then the internal
+   format is the compressed one and the pixel format and type are 0.
+   Drivers without the format get the levels decompressed on the CPU.
+
+   Layout, all little endian:
+      ytx_header_t
+      ytx_level_t for every mip level, the largest first
+      pixel data of the levels, each starting at a multiple of YTX_ALIGNMENT
+
+   tools/png2ytx.cpp converts PNG files.
+*/
+
+namespace yam
+{
+   namespace format
+   {
+      constexpr int YTX = 2;
+   }
+
+   constexpr uint32_t YTX_VERSION   = 1;
+   constexpr size_t   YTX_ALIGNMENT = 16;
+
+   struct ytx_header_t
+   {
+      char              magic[4];
+      uint32_t          version;
+
+      uint32_t          width;
+      uint32_t          height;
+      uint32_t          channels;
+      uint32_t          levels;
+
+      // What the texture storage is created with
+      uint32_t          internal_format;
+      uint32_t          pixel_format;
+      uint32_t          pixel_type;
+
+      // texture_params_t, the mipmaps come from the levels
+      uint32_t          filter;
+      uint32_t          wrap;
+
+      uint32_t          reserved;
+   };
+
+   struct ytx_level_t
+   {
+      uint64_t          offset;      // from the start of the file
+      uint64_t          size;
+
+      uint32_t          width;
+      uint32_t          height;
+   };
+
+   // An open container, the level table and pixels point into the mapping
+   struct ytx_file_t
+   {
+      MappedFile           mapping;
+      ytx_header_t         header;
+      const ytx_level_t*   levels;
+
+      const uint8_t* Level(uint32_t level) const
+      {
+         return mapping.Data() + levels[level].offset;
+      }
+   };
+
+   // The GL formats Renderer::CreateTexture uses for 8 bit images with this many channels
+   inline bool ytx_formats(uint32_t channels, uint32_t* internal_format, uint32_t* pixel_format)
+   {
+      static const uint32_t internal_formats[] = { 0, GL_RED, GL_RG, GL_RGB, GL_RGBA8 };
+      static const uint32_t pixel_formats[] = { 0, GL_RED, GL_RG, GL_RGB, GL_RGBA };
+
+      if ((channels < 1) || (channels > 4))
+         return false;
+
+      *internal_format = internal_formats[channels];
+      *pixel_format = pixel_formats[channels];
+
+      return true;
+   }
+
+   inline size_t ytx_level_size(const ytx_header_t& header, uint32_t w, uint32_t h)
+   {
+      if (bcn_block_bytes(header.internal_format) != 0)
+         return bcn_level_size(header.internal_format, w, h);
+
+      return (size_t)w * h * header.channels;
+   }
+
+   inline bool ytx_valid_format(const ytx_header_t& header)
+   {
+      if (bcn_block_bytes(header.internal_format) != 0)
+      {
+         return (bcn_channels(header.internal_format) == header.channels)
+             && (header.pixel_format == 0) && (header.pixel_type == 0);
+      }
+
+      uint32_t internal_format, pixel_format;
+
+      return ytx_formats(header.channels, &internal_format, &pixel_format)
+          && (header.internal_format == internal_format) && (header.pixel_format == pixel_format)
+          && (header.pixel_type == GL_UNSIGNED_BYTE);
+   }
+
+   // Maps a container and checks that every level lies inside the file
+   inline uint32_t ytx_open(const wcl::string& file, ytx_file_t& ytx)
+   {
+      if (ytx.mapping.Open(file) != WHEEL_OK)
+      {
+         log(ERROR, "Can't open texture ", file, "\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      const size_t size = ytx.mapping.Size();
+
+      if (size < sizeof(ytx_header_t))
+      {
+         log(ERROR, "Truncated texture file ", file, "\n");
+         return WHEEL_UNEXPECTED_END_OF_FILE;
+      }
+
+      ytx_header_t& header = ytx.header;
+      memcpy(&header, ytx.mapping.Data(), sizeof(header));
+
+      if ((memcmp(header.magic, "YTEX", 4) != 0) || (header.version != YTX_VERSION))
+      {
+         log(ERROR, file, " is not a version ", YTX_VERSION, " yam texture\n");
+         return WHEEL_INVALID_FORMAT;
+      }
+
+      if (!ytx_valid_format(header))
+      {
+         log(ERROR, "Unsupported pixel format in texture ", file, "\n");
+         return WHEEL_INVALID_FORMAT;
+      }
+
+      // Either the image alone or its whole mip chain
+      if ((header.width == 0) || (header.height == 0)
+      || ((header.levels != 1) && (header.levels != mip_level_count(header.width, header.height))))
+      {
+         log(ERROR, "Invalid size in texture ", file, "\n");
+         return WHEEL_INVALID_FORMAT;
+      }
+
+      const size_t table_end = sizeof(ytx_header_t) + sizeof(ytx_level_t) * header.levels;
+
+      if (size < table_end)
+      {
+         log(ERROR, "Truncated texture file ", file, "\n");
+         return WHEEL_UNEXPECTED_END_OF_FILE;
+      }
+
+      ytx.levels = (const ytx_level_t*)(ytx.mapping.Data() + sizeof(ytx_header_t));
+
+      for (uint32_t i = 0; i < header.levels; ++i)
+      {
+         const ytx_level_t& level = ytx.levels[i];
+
+         if ((level.width != std::max(1u, header.width >> i))
+         || (level.height != std::max(1u, header.height >> i))
+         || (level.size != ytx_level_size(header, level.width, level.height))
+         || (level.offset < table_end) || (level.offset > size) || (level.size > size - level.offset))
+         {
+            log(ERROR, "Corrupt mip level ", i, " in texture ", file, "\n");
+            return WHEEL_INVALID_FORMAT;
+         }
+      }
+
+      return WHEEL_OK;
+   }
+
+   /*
+      Builds a container out of a top-down image.  With mipmaps in params
+      the whole chain gets stored, otherwise only the image itself.  A
+      compression format like TEXTURE_BC1 compresses every level, and
+      decides the channel count of the texture.
+   */
+   inline uint32_t encode_ytx(const image_t& src, wcl::buffer_t& output,
+                              const texture_params_t& params = texture_params_t(),
+                              uint32_t compression = 0)
+   {
+      ytx_header_t header;
+      memset(&header, 0, sizeof(header));
+
+      memcpy(header.magic, "YTEX", 4);
+      header.version = YTX_VERSION;
+      header.width = src.width;
+      header.height = src.height;
+      header.channels = src.channels;
+      header.pixel_type = GL_UNSIGNED_BYTE;
+      header.filter = params.filter;
+      header.wrap = params.wrap;
+
+      if ((src.width == 0) || (src.height == 0)
+      || !ytx_formats(src.channels, &header.internal_format, &header.pixel_format)
+      || (src.image.size() < (size_t)src.width * src.height * src.channels))
+      {
+         log(ERROR, "Can't store a ", src.width, "x", src.height, " image with ", src.channels,
+             " channels as a texture\n");
+         return WHEEL_INVALID_VALUE;
+      }
+
+      if (compression != 0)
+      {
+         if (bcn_block_bytes(compression) == 0)
+         {
+            log(ERROR, "Unknown texture compression ", compression, "\n");
+            return WHEEL_INVALID_VALUE;
+         }
+
+         header.channels = bcn_channels(compression);
+         header.internal_format = compression;
+         header.pixel_format = 0;
+         header.pixel_type = 0;
+      }
+
+      // Flipped before the mip chain is built, so a smaller level covers the same texels as in GL
+      std::vector<image_t> chain(1, src);
+      flip_vertical(chain[0]);
+
+      if (params.mipmaps != TEXTURE_MIPMAPS_NONE)
+      {
+         std::vector<image_t> smaller;
+         build_mipmaps(chain[0], smaller);
+
+         for (image_t& level : smaller)
+            chain.push_back(std::move(level));
+      }
+
+      header.levels = chain.size();
+
+      // Compressed levels replace the pixels of the chain
+      if (compression != 0)
+      {
+         for (image_t& level : chain)
+         {
+            wcl::buffer_t blocks;
+
+            uint32_t result = compress_bcn(level, compression, blocks);
+
+            if (result != WHEEL_OK)
+               return result;
+
+            level.image.swap(blocks);
+         }
+      }
+
+      std::vector<ytx_level_t> levels(chain.size());
+      size_t offset = sizeof(ytx_header_t) + sizeof(ytx_level_t) * levels.size();
+
+      for (size_t i = 0; i < chain.size(); ++i)
+      {
+         offset = (offset + YTX_ALIGNMENT - 1) & ~(YTX_ALIGNMENT - 1);
+
+         levels[i].offset = offset;
+         levels[i].width = chain[i].width;
+         levels[i].height = chain[i].height;
+         levels[i].size = ytx_level_size(header, chain[i].width, chain[i].height);
+
+         offset += levels[i].size;
+      }
+
+      output.clear();
+      output.resize(offset);
+
+      memcpy(&output[0], &header, sizeof(header));
+      memcpy(&output[sizeof(header)], &levels[0], sizeof(ytx_level_t) * levels.size());
+
+      for (size_t i = 0; i < chain.size(); ++i)
+         memcpy(&output[levels[i].offset], &chain[i].image[0], levels[i].size);
+
+      return WHEEL_OK;
+   }
+
+   inline uint32_t save_ytx(const wcl::string& filename, const image_t& src,
+                            const texture_params_t& params = texture_params_t(),
+                            uint32_t compression = 0)
+   {
+      wcl::buffer_t output;
+
+      uint32_t result = encode_ytx(src, output, params, compression);
+
+      if (result != WHEEL_OK)
+         return result;
+
+      FILE* file = fopen(filename.std_str().c_str(), "wb");
+
+      if (file == nullptr)
+      {
+         log(ERROR, "Can't open ", filename, " for writing\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      size_t written = fwrite(&output[0], 1, output.size(), file);
+      fclose(file);
+
+      if (written != output.size())
+      {
+         log(ERROR, "Failed to write ", filename, "\n");
+         return WHEEL_ERROR;
+      }
+
+      return WHEEL_OK;
+   }
+
+   // Copies the largest level out, the stored rows are bottom-up so IMAGE_BOTTOM_UP skips the flip
+   template<>
+   inline uint32_t load_to_buffer<format::YTX>(image_t& target, const wcl::string& file, uint32_t flags)
+   {
+      ytx_file_t ytx;
+
+      uint32_t result = ytx_open(file, ytx);
+
+      if (result != WHEEL_OK)
+         return result;
+
+      if (bcn_block_bytes(ytx.header.internal_format) != 0)
+      {
+         decompress_bcn(ytx.Level(0), ytx.header.width, ytx.header.height, ytx.header.internal_format, target);
+      } else {
+         target.width = ytx.header.width;
+         target.height = ytx.header.height;
+         target.channels = ytx.header.channels;
+         target.image.assign(ytx.Level(0), ytx.Level(0) + ytx.levels[0].size);
+      }
+
+      if (!(flags & IMAGE_BOTTOM_UP))
+         flip_vertical(target);
+
+      return WHEEL_OK;
+   }
+
+   template<>
+   inline uint32_t load_to_texture<format::YTX>(const wcl::string& texture, const wcl::string& file, uint32_t)
+   {
+      ytx_file_t ytx;
+
+      uint32_t result = ytx_open(file, ytx);
+
+      if (result != WHEEL_OK)
+         return result;
+
+      const ytx_header_t& header = ytx.header;
+      texture_params_t params(header.filter,
+                              (header.levels > 1) ? TEXTURE_MIPMAPS_CPU : TEXTURE_MIPMAPS_NONE,
+                              header.wrap);
+
+      const bool compressed = (bcn_block_bytes(header.internal_format) != 0);
+
+      if (compressed && renderer.SupportsCompressedFormat(header.internal_format))
+      {
+         result = renderer.CreateCompressedTexture(texture, header.width, header.height, header.channels,
+                                                   header.internal_format, params);
+
+         for (uint32_t i = 0; (result == WHEEL_OK) && (i < header.levels); ++i)
+         {
+            result = renderer.UploadCompressedTextureData(texture, i, ytx.levels[i].width, ytx.levels[i].height,
+                                                          ytx.Level(i), ytx.levels[i].size);
+         }
+
+         return result;
+      }
+
+      if (compressed)
+      {
+         static bool warned = false;
+
+         if (!warned)
+            log(WARNING, "Compressed texture format not supported, decompressing textures on the CPU\n");
+
+         warned = true;
+      }
+
+      result = renderer.CreateTexture(texture, header.width, header.height, header.channels,
+                                      WHEEL_UNSIGNED_BYTE, params);
+
+      image_t decompressed;
+
+      for (uint32_t i = 0; (result == WHEEL_OK) && (i < header.levels); ++i)
+      {
+         const uint8_t* pixels = ytx.Level(i);
+
+         if (compressed)
+         {
+            decompress_bcn(pixels, ytx.levels[i].width, ytx.levels[i].height, header.internal_format,
+                           decompressed);
+            pixels = &decompressed.image[0];
+         }
+
+         result = renderer.UploadTextureData(texture, 0, 0, ytx.levels[i].width, ytx.levels[i].height,
+                                             (void*)pixels, i);
+      }
+
+      return result;
+   }
+}
+
+#endif
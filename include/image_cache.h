@@ -0,0 +1,78 @@
+#ifndef YAM_IMAGE_CACHE_H
+#define YAM_IMAGE_CACHE_H
+
+#include "common.h"
+#include "image.h"
+#include "mapped_file.h"
+
+namespace yam
+{
+   // 64 bit hash of a block of memory, for content addressing rather than security
+   uint64_t hash_bytes(const uint8_t* data, size_t len, uint64_t seed = 0);
+
+   // Header in front of the pixels of every cache file
+   struct image_cache_header_t
+   {
+      char              magic[4];
+      uint32_t          version;
+
+      uint64_t          source_hash;
+      uint64_t          source_size;
+
+      uint32_t          width;
+      uint32_t          height;
+      uint32_t          channels;
+      uint32_t          flags;
+
+      uint32_t          levels;
+      uint32_t          reserved;
+   };
+
+   // A decoded image, either mapped from the cache or freshly decoded
+   struct cached_image_t
+   {
+      uint32_t          width;
+      uint32_t          height;
+      uint32_t          channels;
+      uint32_t          levels;
+
+      // All mip levels back to back, the largest first
+      const uint8_t*    pixels;
+
+      bool              hit;
+
+      MappedFile        mapping;
+      image_t           decoded;
+   };
+
+   /*
+      On-disk cache of decoded images, keyed by a hash of the bytes of the
+      source file and the load flags that change the pixels.  A hit is a
+      memory mapped raw pixel blob that needs no decoding at all, a miss
+      decodes the file and stores the result for the next launch.  With
+      IMAGE_MIPMAPS the entry holds the whole mip chain.
+   */
+   class ImageCache
+   {
+      private:
+         wcl::string       directory;
+
+         wcl::string       CachePath(uint64_t key) const;
+         uint32_t          Store(const wcl::string& path, const image_cache_header_t& header,
+                                 const image_t& image) const;
+
+      public:
+         // Takes the same flags as load_to_buffer, IMAGE_BOTTOM_UP is usually wanted
+         uint32_t          Fetch(const wcl::string& file, cached_image_t& result,
+                                 uint32_t flags = IMAGE_BOTTOM_UP);
+
+         // CPU mipmaps in params are cached with the image, as if IMAGE_MIPMAPS was in flags
+         uint32_t          LoadTexture(const wcl::string& texture, const wcl::string& file,
+                                       uint32_t flags = IMAGE_BOTTOM_UP,
+                                       const texture_params_t& params = texture_params_t());
+
+         ImageCache(const wcl::string& directory = "cache");
+   };
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef YAM_LOADER_H
+#define YAM_LOADER_H
+
+#include "common.h"
+#include "threadpool.hpp"
+
+#include <deque>
+
+namespace yam
+{
+   struct load_request_t
+   {
+      wcl::string       texture;
+      wcl::string       file;
+   };
+
+   // Called on the GL thread after the texture has been created, or with the error that prevented it
+   typedef std::function<void(const wcl::string& texture, uint32_t result)> load_callback_t;
+
+   class ImageLoader; extern ImageLoader image_loader;
+
+   /*
+      Decodes batches of image files on a worker pool.  Decoded images wait
+      in a queue until Upload() is called from the thread that owns the GL
+      context, which creates the textures and calls the completion
+      callbacks.  Game::Run does that once per frame.
+
+      The workers read their files into buffers of their own.  The wcl
+      buffer registry belongs to the main thread, which loads through it
+      without any locking.  Workers don't write to the log either, what
+      they log is kept with the image and written by Upload().
+   */
+   class ImageLoader
+   {
+      private:
+         struct decoded_t
+         {
+            wcl::string       texture;
+            image_t           image;
+            uint32_t          result;
+            load_callback_t   done;
+
+            // What the worker logged, written out by Upload() on the main thread
+            std::string       messages;
+         };
+
+         ThreadPool                                   pool;
+
+         // Guards the decoded queue
+         std::mutex                                   lock;
+         std::deque<decoded_t>                        decoded;
+
+         // Requests not uploaded yet, only used on the GL thread
+         size_t                                       pending;
+
+         void              Decode(const load_request_t& request, const load_callback_t& done);
+
+      public:
+         uint32_t          LoadTextures(const std::vector<load_request_t>& batch,
+                                        const load_callback_t& done = load_callback_t());
+
+         // Creates textures for up to max_uploads decoded images, returns how many it did
+         uint32_t          Upload(uint32_t max_uploads = ~0u);
+
+         // Blocks until the whole queue is decoded, then uploads it
+         void              Finish();
+
+         size_t            Pending() const { return pending; }
+
+         ImageLoader(uint32_t threads = 0) : pool(threads), pending(0) {}
+   };
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef YAM_MAPPED_FILE_H
+#define YAM_MAPPED_FILE_H
+
+#include "common.h"
+
+namespace yam
+{
+   /*
+      Read-only memory mapping of a whole file.  The pages are only read
+      from disk when they are touched, and stay shared with the page cache.
+   */
+   class MappedFile
+   {
+      private:
+         const uint8_t*    ptr;
+         size_t            len;
+
+      public:
+         uint32_t          Open(const wcl::string& path);
+         void              Close();
+
+         bool              IsOpen() const { return ptr != nullptr; }
+         const uint8_t*    Data() const { return ptr; }
+         size_t            Size() const { return len; }
+
+         MappedFile() : ptr(nullptr), len(0) {}
+         MappedFile(const MappedFile&) = delete;
+         MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile() { Close(); }
+   };
+}
+
+#endif
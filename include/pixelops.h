@@ -0,0 +1,98 @@
+#ifndef YAM_PIXELOPS_H
+#define YAM_PIXELOPS_H
+
+#include "common.h"
+
+/*
+   Bulk pixel operations on image_t.
+
+   Colours are packed 0xRRGGBBAA, like image_t::pixel_access_t uses them.
+   Images with fewer than four channels use the leading bytes of the
+   colour, so a 3 channel image compares and writes 0xRRGGBB.
+
+   The row kernels take a run of tightly packed pixels.  image_t rows are
+   packed without padding, so the whole image operations are a single
+   call over all of its pixels.  The 4 channel kernels are vectorized.
+*/
+
+namespace yam
+{
+   // Row kernels
+   void replace_colour_row(uint8_t* row, size_t pixels, uint32_t channels, uint32_t from, uint32_t to);
+   void remap_palette_row(uint8_t* row, size_t pixels, uint32_t channels,
+                          const uint32_t* from, const uint32_t* to, size_t count);
+   void premultiply_alpha_row(uint8_t* row, size_t pixels);
+   void swizzle_row(uint8_t* row, size_t pixels, const uint8_t order[4]);
+   void fill_row(uint8_t* row, size_t pixels, uint32_t channels, uint32_t colour);
+
+   // Box filters two source rows into a row of width pixels, half the width of the source
+   void downsample_row(uint8_t* out, const uint8_t* row0, const uint8_t* row1,
+                       size_t width, size_t src_width, uint32_t channels);
+
+   // Replaces every pixel of colour from with to
+   uint32_t replace_colour(image_t& img, uint32_t from, uint32_t to);
+
+   // Replaces from[i] with to[i], the first match wins.  Meant for a handful of colours
+   uint32_t remap_palette(image_t& img, const palette_t& from, const palette_t& to);
+
+   // Multiplies the colour channels of an RGBA image by its alpha
+   uint32_t premultiply_alpha(image_t& img);
+
+   // Reorders the channels of an RGBA image, swizzle_channels(img, 2, 1, 0, 3) turns RGBA into BGRA
+   uint32_t swizzle_channels(image_t& img, uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+
+   uint32_t fill_image(image_t& img, uint32_t colour);
+   // The rectangle is clipped to the image
+   uint32_t fill_rect(image_t& img, size_t x, size_t y, size_t w, size_t h, uint32_t colour);
+
+   // Number of levels in a full mip chain, down to 1x1
+   inline uint32_t mip_level_count(uint32_t w, uint32_t h)
+   {
+      uint32_t levels = 1;
+
+      for (uint32_t size = std::max(w, h); size > 1; size >>= 1)
+         levels++;
+
+      return levels;
+   }
+
+   // Whether a GL pixel type is one of the 16 bit layouts below
+   inline bool is_packed_type(uint32_t type)
+   {
+      return (type == GL_UNSIGNED_SHORT_5_6_5) || (type == GL_UNSIGNED_SHORT_4_4_4_4)
+          || (type == GL_UNSIGNED_SHORT_5_5_5_1);
+   }
+
+   // Channels a texture of a 16 bit layout gets created with
+   inline uint32_t packed_channels(uint32_t type)
+   {
+      return (type == GL_UNSIGNED_SHORT_5_6_5) ? 3 : 4;
+   }
+
+   /*
+      Packs RGB or RGBA pixels into GL_UNSIGNED_SHORT_5_6_5, _4_4_4_4 or
+      _5_5_5_1 texels.  thresholds are the ordered dither thresholds out of
+      255 for x modulo 4, without them every channel is rounded.
+   */
+   void pack_row_16(uint16_t* out, const uint8_t* row, size_t pixels, uint32_t channels,
+                    uint32_t type, const uint16_t* thresholds);
+
+   // The pixel type a texture_params_t storage policy picks for the pixels, 0 keeps 8 bits per channel
+   uint32_t packed_pixel_type(uint32_t storage, const uint8_t* pixels, size_t count, uint32_t channels);
+
+   // Packs a whole image, dithering with a 4x4 Bayer matrix hides the banding of gradients
+   uint32_t pack_pixels_16(const uint8_t* pixels, uint32_t w, uint32_t h, uint32_t channels,
+                           uint32_t type, bool dither, wcl::buffer_t& output);
+
+   /*
+      Halves the image with a 2x2 box filter, sizes round down so an odd
+      width or height leaves out its last column or row.  A side of 1 stays
+      1, the second tap is clamped to the same column or row.
+   */
+   uint32_t downsample(const image_t& src, image_t& dst);
+
+   // Fills levels with mip levels 1 and up of base, each half the size of the one before
+   uint32_t build_mipmaps(const image_t& base, std::vector<image_t>& levels);
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef YAM_REGISTRY_H
+#define YAM_REGISTRY_H
+
+#include "common.h"
+
+#include <memory>
+
+namespace yam
+{
+   /*
+      Names a slot of a Registry<T>.  Cheap to copy and compare, and it goes
+      stale when its name is removed from the registry, so a handle kept
+      around can't reach whatever reuses the slot later.  The default handle
+      names nothing.
+   */
+   template<typename T>
+   struct handle_t
+   {
+      uint32_t          index;
+      uint32_t          generation;
+
+      handle_t() : index(0), generation(0) {}
+      handle_t(uint32_t index, uint32_t generation) : index(index), generation(generation) {}
+
+      explicit operator bool() const { return generation != 0; }
+
+      bool operator==(const handle_t& other) const
+      {
+         return (index == other.index) && (generation == other.generation);
+      }
+
+      bool operator!=(const handle_t& other) const { return !(*this == other); }
+   };
+
+   /*
+      Resources by handle, with names for loading them.  The slots are one
+      dense array, a handle is an index into it and the generation the slot
+      had when the handle was made.  Names only map to slots in Acquire()
+      and Find(), which belong in load time code, anything done per frame
+      goes through handles.
+
+      A name keeps its slot while the resource comes and goes, so a handle
+      taken before the resource exists, or while it's evicted, works once
+      it's back.  Remove() gives up the name and the slot.  Items are kept
+      by pointer and don't move when the array grows.
+   */
+   template<typename T>
+   class Registry
+   {
+      private:
+         struct slot_t
+         {
+            std::unique_ptr<T>   item;
+            wcl::string          name;
+            uint32_t             generation;
+         };
+
+         std::vector<slot_t>                          slots;
+         std::vector<uint32_t>                        free_slots;
+         std::unordered_map<wcl::string, uint32_t>    names;
+
+         inline const slot_t* slot(handle_t<T> handle) const
+         {
+            if ((handle.index >= slots.size()) || (slots[handle.index].generation != handle.generation))
+               return nullptr;
+
+            return &slots[handle.index];
+         }
+
+      public:
+         // The handle of name, with an empty slot if it's new
+         handle_t<T> Acquire(const wcl::string& name)
+         {
+            auto found = names.find(name);
+
+            if (found != names.end())
+               return handle_t<T>(found->second, slots[found->second].generation);
+
+            uint32_t index;
+
+            if (free_slots.empty())
+            {
+               index = slots.size();
+               slots.emplace_back();
+               slots[index].generation = 1;
+            } else {
+               index = free_slots.back();
+               free_slots.pop_back();
+            }
+
+            slots[index].name = name;
+            names[name] = index;
+
+            return handle_t<T>(index, slots[index].generation);
+         }
+
+         // The handle of name, or no handle if it's not known
+         handle_t<T> Find(const wcl::string& name) const
+         {
+            auto found = names.find(name);
+
+            if (found == names.end())
+               return handle_t<T>();
+
+            return handle_t<T>(found->second, slots[found->second].generation);
+         }
+
+         // Null when the handle is stale or nothing is loaded under it
+         inline T* Get(handle_t<T> handle) const
+         {
+            const slot_t* found = slot(handle);
+            return (found != nullptr) ? found->item.get() : nullptr;
+         }
+
+         // For the APIs that take names, one lookup
+         inline T* Get(const wcl::string& name) const
+         {
+            return Get(Find(name));
+         }
+
+         // The item in a slot whatever its generation, for indices packed into sort keys
+         inline T* At(uint32_t index) const
+         {
+            return (index < slots.size()) ? slots[index].item.get() : nullptr;
+         }
+
+         inline const wcl::string& Name(handle_t<T> handle) const
+         {
+            static const wcl::string none;
+
+            const slot_t* found = slot(handle);
+            return (found != nullptr) ? found->name : none;
+         }
+
+         // Puts item in the slot of handle, replacing what was there
+         T* Set(handle_t<T> handle, T&& item)
+         {
+            if (slot(handle) == nullptr)
+               return nullptr;
+
+            slots[handle.index].item.reset(new T(std::move(item)));
+
+            return slots[handle.index].item.get();
+         }
+
+         inline T* Insert(const wcl::string& name, T&& item)
+         {
+            return Set(Acquire(name), std::move(item));
+         }
+
+         // Drops the item, the name and its handles stay
+         void Clear(handle_t<T> handle)
+         {
+            if (slot(handle) != nullptr)
+               slots[handle.index].item.reset();
+         }
+
+         // Drops the item and the name, handles to it go stale
+         void Remove(handle_t<T> handle)
+         {
+            if (slot(handle) == nullptr)
+               return;
+
+            slot_t& removed = slots[handle.index];
+
+            names.erase(removed.name);
+            removed.item.reset();
+            removed.name = "";
+
+            // 0 is the generation of no handle
+            if (++removed.generation == 0)
+               removed.generation = 1;
+
+            free_slots.push_back(handle.index);
+         }
+
+         size_t Size() const { return slots.size(); }
+   };
+
+   class Shader;
+   struct atlas_t;
+   struct rendertarget_t;
+
+   typedef handle_t<texture_t>         texture_handle_t;
+   typedef handle_t<Shader>            shader_handle_t;
+   typedef handle_t<atlas_t>           atlas_handle_t;
+   typedef handle_t<rendertarget_t>    target_handle_t;
+
+   // A sprite in an atlas, only means something with the atlas it came from
+   typedef handle_t<wheel::rect_t>     sprite_handle_t;
+}
+
+#endif
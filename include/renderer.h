@@ -5,99 +5,23 @@
 #include "debug.hpp"
 #include "shader.h"
 #include "font.h"
-
-#include <map>
-
-namespace yam
-{
-   struct vertex_t
-   {
-      float x0, y0;
-      uint16_t s0, t0;
-      uint8_t r, g, b, a;
-
-      vertex_t() {}
-      vertex_t(float x, float y) : x0(x), y0(y) {}
-   };
-
-   struct rord_t
-   {
-      uint32_t       z_order;
-      wcl::string    shader;
-      GLenum         array_type;
-/*
-      inline size_t hash() const noexcept
-      {
-         return (shader.hash() + z_order) ^ array_type;
-      }
-*/
-      bool operator<(const rord_t& value) const
-      {
-         return std::tie(value.z_order, shader, value.array_type)
-              < std::tie(z_order, value.shader, array_type);
-      }
-/*
-      bool operator==(const rord_t& other) const
-      {
-         if ((z_order == other.z_order) && (shader == other.shader)
-         && (array_type == other.array_type))
-            return true;
-
-         return false;
-      }
-*/
-      rord_t(uint32_t z, const wcl::string& mat, GLenum at = GL_TRIANGLES)
-      {
-         z_order = z;
-         shader = mat;
-         array_type = at;
-      }
-   };
-}
-
-namespace std
-{
-/*
-   template<>
-   struct hash<yam::rord_t>
-   {
-      size_t operator()(const yam::rord_t& __s) const noexcept
-      {
-         return __s.hash();
-      }
-   };
-*/
-}
-
+#include "residency.h"
+#include "draw_queue.h"
+#include "stream_buffer.h"
+#include "vertex_format.h"
+#include "registry.h"
 
 namespace yam {
 
-   struct rbuffer_t
-   {
-      GLuint            vbo;
-      wheel::buffer_t   vertex_data;
-
-      rbuffer_t()
-      {
-         glGenBuffers(1, &vbo);
-      }
-
-      ~rbuffer_t()
-      {
-         glDeleteBuffers(1, &vbo);
-      }
-   };
-
    struct atlas_t
    {
       wheel::Atlas      atlas;
 
-      texture_t*        texture;
+      texture_handle_t  texture;
       uint32_t          size;
 
-      std::unordered_map<wcl::string, wheel::rect_t> stored;
-
-      atlas_t() : texture(nullptr) {}
+      // Where the sprites are, by sprite_handle_t
+      Registry<wheel::rect_t> stored;
    };
 
    struct rendertarget_t
@@ -119,18 +43,18 @@ namespace yam {
          {
             private:
                bool              in_use;
-               wcl::string       texture;
+               texture_handle_t  texture;
                static uint32_t   active;
 
                const bool        usable;
                const uint32_t    number;
             public:
 
-               tu_info_t(uint32_t n) : in_use(false), texture("null"), number(n), usable(true) {}
-               tu_info_t(bool) : in_use(true), texture("out of bounds"), number(0), usable(false) {}
+               tu_info_t(uint32_t n) : in_use(false), number(n), usable(true) {}
+               tu_info_t(bool) : in_use(true), number(0), usable(false) {}
 
                const bool& used() { return in_use; };
-               const wcl::string& current() { return texture; }
+               texture_handle_t current() { return texture; }
 
                static inline uint32_t active_unit() { return active; }
 
@@ -143,18 +67,28 @@ namespace yam {
                   glActiveTexture(GL_TEXTURE0 + number);
                   glBindTexture(GL_TEXTURE_2D, 0);
 
-                  texture = "null";
+                  texture = texture_handle_t();
                   in_use = false;
 
                   if (active != number)
                      glActiveTexture(GL_TEXTURE0 + active);
                }
 
+               // Empties the unit
+               inline void operator=(std::nullptr_t)
+               {
+                  operator=((void*)nullptr);
+               }
+
                inline void operator=(const char* texture)
                {
                   operator=((wcl::string)texture);
                }
-               void operator=(const wcl::string& new_texture)
+               inline void operator=(const wcl::string& new_texture)
+               {
+                  operator=(renderer.TextureHandle(new_texture));
+               }
+               void operator=(texture_handle_t new_texture)
                {
                   if (!usable)
                   {
@@ -162,18 +96,23 @@ namespace yam {
                      return;
                   }
 
-                  bool is_atlas = false;
-                  if (renderer.texture.count(new_texture) == 0)
+                  // An evicted texture gets loaded again before it's bound
+                  if (!texture_residency.Touch(new_texture))
+                     return;
+
+                  const texture_t* tex = renderer.textures.Get(new_texture);
+
+                  if (tex == nullptr)
                   {
                      log(WARNING, "Tried to set texture unit ",number," to texture '",
-                         new_texture,"', which doesn't exist.\n");
+                         renderer.textures.Name(new_texture),"', which doesn't exist.\n");
                          return;
                   }
 
-                  log(FULL_DEBUG, "bound TU ", number, " to ", new_texture,"\n");
+                  log(FULL_DEBUG, "bound TU ", number, " to ", renderer.textures.Name(new_texture),"\n");
 
                   glActiveTexture(GL_TEXTURE0 + number);
-                  glBindTexture(GL_TEXTURE_2D, renderer.texture[new_texture].id);
+                  glBindTexture(GL_TEXTURE_2D, tex->id);
 
                   texture = new_texture;
                   active = true;
@@ -247,8 +186,10 @@ namespace yam {
       {
          Shader& operator[](const wcl::string& sh)
          {
-            if (renderer.shaderlist.count(sh))
-               return renderer.shaderlist[sh];
+            Shader* found = renderer.shaders.Get(sh);
+
+            if (found != nullptr)
+               return *found;
 
             assert(0 && "array index out of range");
          }
@@ -260,23 +201,44 @@ namespace yam {
 
          bool           alive;
 
-         wcl::string    current_shader;
-         wcl::string    current_target;
+         shader_handle_t   current_shader;
+         target_handle_t   current_target;
 
-         std::unordered_map<wcl::string, Shader>      shaderlist;
+         // In the draw keys, 0 when no shader is set and the slot of current_shader + 1 otherwise
+         uint32_t          current_program;
+
+         Registry<Shader>                             shaders;
          std::unordered_map<wcl::string, Font>        fontlist;
 
-         std::unordered_map<wcl::string, texture_t>   texture;
-         std::unordered_map<wcl::string, atlas_t>     atlas;
-         std::unordered_map<wcl::string, rendertarget_t> target;
+         Registry<texture_t>                          textures;
+         Registry<atlas_t>                            atlases;
+         Registry<rendertarget_t>                     targets;
 
-         std::map<rord_t, rbuffer_t>                  buffers;
+         // This frame's draws, and the mapped buffer they get sorted into
+         DrawQueue                                    draw_queue;
+         SpriteQueue                                  sprite_queue;
+         StreamBuffer                                 vertex_stream;
 
-         inline rbuffer_t& select_buffer(uint32_t z, const wcl::string& shader,
-                                         GLenum etype = GL_TRIANGLES)
-         {
-            return buffers[rord_t(z, shader, etype)];
-         }
+         // Layouts of vertex_t and sprite_instance_t, each with its own VAO
+         VertexFormat                                 vertex_format;
+         VertexFormat                                 sprite_format;
+
+         // Two triangles per quad for every DRAW_QUADS batch, as long as the largest one so far
+         GLuint                                       quad_indices;
+         uint32_t                                     quad_capacity;
+         GLenum                                       quad_index_type;
+
+         // Pixel unpack buffer texture data gets decoded into
+         GLuint                                       pixel_buffer;
+
+         // Scratch space for pixels packed into 16 bit texels before the upload
+         wcl::buffer_t                                packed_pixels;
+
+         // Sets the sampler state of the bound texture
+         void     apply_texture_params(const texture_t& tex);
+
+         // Has to be called with the vertex_format VAO bound, the index buffer binding is part of it
+         void     reserve_quad_indices(uint32_t quads);
 
       public:
          TextureUnits                                 texture_unit;
@@ -285,12 +247,34 @@ namespace yam {
          uint32_t                                     scrw;
          uint32_t                                     scrh;
 
+         /*
+            Handles for the resources by name.  They can be taken before the
+            resource is loaded and stay valid while it's replaced or evicted,
+            so look them up once and keep them, the handle overloads below
+            don't touch any strings.
+         */
+         inline shader_handle_t  ShaderHandle(const wcl::string& name)   { return shaders.Acquire(name); }
+         inline texture_handle_t TextureHandle(const wcl::string& name)  { return textures.Acquire(name); }
+         inline atlas_handle_t   AtlasHandle(const wcl::string& name)    { return atlases.Acquire(name); }
+         inline target_handle_t  TargetHandle(const wcl::string& name)   { return targets.Acquire(name); }
+
+         // Only for sprites already in the atlas
+         sprite_handle_t SpriteHandle(atlas_handle_t atlas, const wcl::string& sprite);
+
+         inline const wcl::string& TextureName(texture_handle_t texture) { return textures.Name(texture); }
+
+         // Like TextureHandle(), without making a slot for names it doesn't know
+         inline texture_handle_t FindTexture(const wcl::string& name) const { return textures.Find(name); }
+
          uint32_t AddShader(const wcl::string& name, Shader&& shader);
          uint32_t UseShader(const wcl::string& name);
+         uint32_t UseShader(shader_handle_t shader);
 
          void     SetShader(const wcl::string& name);
+         void     SetShader(shader_handle_t shader);
 
-         inline wcl::string GetShader() { return current_shader; }
+         inline wcl::string GetShader() { return shaders.Name(current_shader); }
+         inline shader_handle_t CurrentShader() { return current_shader; }
 
          // Render to texture, etc.
          uint32_t CreateTarget(const wcl::string& name,
@@ -301,80 +285,150 @@ namespace yam {
 
          void     SetTarget(const wcl::string& name);
 
+         // No handle is the window
+         void     SetTarget(target_handle_t target);
+
          inline void SetTarget(int)
          {
-            SetTarget("");
+            SetTarget(target_handle_t());
          }
 
          inline uint32_t GetTargetWidth()
          {
-            if (current_target == "")
-               return scrw;
-
-            return target[current_target].w;
+            const rendertarget_t* rtarget = targets.Get(current_target);
+            return (rtarget != nullptr) ? rtarget->w : scrw;
          }
 
          inline uint32_t GetTargetHeight()
          {
-            if (current_target == "")
-               return scrh;
-
-            return target[current_target].h;
+            const rendertarget_t* rtarget = targets.Get(current_target);
+            return (rtarget != nullptr) ? rtarget->h : scrh;
          }
 
          inline void RebindActiveTarget()
          {
-            if (current_target == "")
-               glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            else
-               glBindFramebuffer(GL_FRAMEBUFFER, target[current_target].id);
+            const rendertarget_t* rtarget = targets.Get(current_target);
+            glBindFramebuffer(GL_FRAMEBUFFER, (rtarget != nullptr) ? rtarget->id : 0);
          }
 
          void     AddVertex(vertex_t vert, uint32_t z_order = 0, GLenum etype = GL_TRIANGLES);
 
-         void     AddVertices(uint32_t layer, vertex_t v)
+         // Room for count vertices of the current shader, filled in place.  Valid until the next vertex is added
+         inline vertex_t* ReserveVertices(uint32_t count, uint32_t layer, GLenum etype = GL_TRIANGLES)
          {
-            AddVertex(v, layer);
+            return draw_queue.Reserve(draw_key(layer, current_program, etype), count);
          }
-         template<typename... Rest>
-         void     AddVertices(uint32_t layer, vertex_t v, Rest... rest)
+
+         // Room for quads quads of 4 vertices each, see DRAW_QUADS
+         inline vertex_t* ReserveQuads(uint32_t quads, uint32_t layer)
          {
-            AddVertex(v, layer);
-            AddVertices(layer, rest...);
+            return draw_queue.Reserve(draw_key(layer, current_program, DRAW_QUADS), quads * 4);
+         }
+
+         // Room for count instanced sprites of the current shader, which has to read them like shaders/sprite.vs
+         inline sprite_instance_t* ReserveSprites(uint32_t count, uint32_t layer)
+         {
+            return sprite_queue.Reserve(draw_key(layer, current_program, DRAW_SPRITES), count);
+         }
+
+         // Adds all of them with one reservation
+         template<typename... Vertices>
+         void     AddVertices(uint32_t layer, Vertices... vertices)
+         {
+            const vertex_t list[] = { vertices... };
+            std::copy(list, list + sizeof...(Vertices), ReserveVertices(sizeof...(Vertices), layer));
          }
 
          void     Flush();
 
+         /*
+            Allocates every mip level when params asks for mipmaps, the data
+            is uploaded separately.  format is the GL pixel type, one of the
+            16 bit layouts like GL_UNSIGNED_SHORT_5_6_5 stores the texture in
+            half the memory of 8 bits per channel.
+         */
          uint32_t CreateTexture(const wcl::string& name,
                                 uint32_t w, uint32_t h,
                                 uint32_t components,
-                                uint32_t format = WHEEL_UNSIGNED_BYTE);
+                                uint32_t format = WHEEL_UNSIGNED_BYTE,
+                                const texture_params_t& params = texture_params_t());
 
-         uint32_t CreateTexture(const wcl::string& name, image_t& image);
+         // Uploads the image and builds its mip chain the way params says, packed if its storage asks for it
+         uint32_t CreateTexture(const wcl::string& name, image_t& image,
+                                const texture_params_t& params = texture_params_t());
 
          uint32_t UploadTextureData(const wcl::string& name,
                                     int32_t xoff, int32_t yoff,
                                     uint32_t width, uint32_t height,
-                                    void* pixel_data);
+                                    void* pixel_data, uint32_t level = 0);
+         uint32_t UploadTextureData(texture_handle_t texture,
+                                    int32_t xoff, int32_t yoff,
+                                    uint32_t width, uint32_t height,
+                                    void* pixel_data, uint32_t level = 0);
 
          uint32_t UploadTextureData(const wcl::string& name, image_t& image);
 
+         // Uploads 8 bit pixels, packed first when the texture stores a 16 bit layout
+         uint32_t UploadTexturePixels(const wcl::string& name, const uint8_t* pixels,
+                                      uint32_t width, uint32_t height, uint32_t channels,
+                                      uint32_t level = 0);
+         uint32_t UploadTexturePixels(texture_handle_t texture, const uint8_t* pixels,
+                                      uint32_t width, uint32_t height, uint32_t channels,
+                                      uint32_t level = 0);
+
          uint32_t UpdateTexture(const wcl::string& name, image_t& image);
+         uint32_t UpdateTexture(texture_handle_t texture, image_t& image);
+
+         // Whether the driver can sample a compressed internal format, like TEXTURE_BC1
+         bool     SupportsCompressedFormat(uint32_t internal_format);
+
+         // A block compressed texture, every level has to be uploaded with UploadCompressedTextureData
+         uint32_t CreateCompressedTexture(const wcl::string& name,
+                                          uint32_t w, uint32_t h,
+                                          uint32_t components,
+                                          uint32_t internal_format,
+                                          const texture_params_t& params = texture_params_t());
 
+         uint32_t UploadCompressedTextureData(const wcl::string& name, uint32_t level,
+                                              uint32_t width, uint32_t height,
+                                              const void* data, size_t size);
+
+         // Rebuilds mip levels 1 and up from level 0 on the GPU
+         uint32_t GenerateMipmaps(const wcl::string& name);
+
+         // Changes filtering and wrapping, the mip chain stays what the texture was created with
+         uint32_t SetTextureParams(const wcl::string& name, const texture_params_t& params);
+
+         // Maps a pixel unpack buffer of size bytes to write texture data into, bottom row first
+         uint8_t* MapPixelBuffer(size_t size);
+
+         // Creates a texture out of the mapped pixel buffer, or drops what was written into it
+         uint32_t CreateTextureFromPixelBuffer(const wcl::string& name,
+                                               uint32_t w, uint32_t h,
+                                               uint32_t components);
+         void     DiscardPixelBuffer();
+
+         // Handles of the name stay valid, creating the texture again brings them back
          void     DeleteTexture(const wcl::string& name);
 
+         // Deletes the texture and gives up its name, the handles go stale
+         void     ForgetTexture(const wcl::string& name);
+
          uint32_t CreateAtlas(const wcl::string& name, uint32_t size,
                               uint32_t components, uint32_t format = WHEEL_UNSIGNED_BYTE);
          uint32_t AtlasBuffer(const wcl::string& atlas_name, const wcl::string& sprite_name,
                               uint32_t w, uint32_t h, void* data);
          uint32_t GetAtlasPos(const wcl::string& atlas_name, const wcl::string& sprite_name,
                               wheel::rect_t* result);
+         uint32_t GetAtlasPos(atlas_handle_t atlas, sprite_handle_t sprite, wheel::rect_t* result);
 
          int32_t  GetTU(const wcl::string& texture_or_atlas);
+         int32_t  GetTU(texture_handle_t texture);
 
          inline void RebindActiveTexture()
          {
-            glBindTexture(GL_TEXTURE_2D, texture[texture_unit[texture_unit[0].active_unit()].current()].id);
+            const texture_t* tex = textures.Get(texture_unit[texture_unit[0].active_unit()].current());
+            glBindTexture(GL_TEXTURE_2D, (tex != nullptr) ? tex->id : 0);
          }
 
          uint32_t Init(uint32_t w = 800, uint32_t h = 480);
@@ -395,11 +449,17 @@ namespace yam {
             Clear(r,g,b,a);
          }
 
-         Renderer() : window(nullptr), context(nullptr), alive(false) {}
+         Renderer() : window(nullptr), context(nullptr), alive(false), current_program(0),
+                      quad_indices(0), quad_capacity(0), quad_index_type(GL_UNSIGNED_SHORT),
+                      pixel_buffer(0) {}
          ~Renderer();
 
          inline bool Alive() { return alive; }
-         inline void Swap() { SDL_GL_SwapWindow(window); }
+         inline void Swap()
+         {
+            vertex_stream.NextFrame();
+            SDL_GL_SwapWindow(window);
+         }
    };
 }
 
@@ -0,0 +1,105 @@
+#ifndef YAM_RESIDENCY_H
+#define YAM_RESIDENCY_H
+
+#include "common.h"
+#include "image.h"
+#include "registry.h"
+
+#include <list>
+
+namespace yam
+{
+   class ImageCache;
+
+   // Recreates an evicted texture under the same name, returns WHEEL_OK if it did
+   typedef std::function<uint32_t(const wcl::string& texture)> texture_source_t;
+
+   // A source that reloads a texture through an image cache, which keeps reloads cheap
+   texture_source_t cached_file_source(ImageCache& cache, const wcl::string& file,
+                                       uint32_t flags = IMAGE_BOTTOM_UP,
+                                       const texture_params_t& params = texture_params_t());
+
+   struct residency_stats_t
+   {
+      size_t            budget;
+      size_t            resident_bytes;
+
+      size_t            resident;
+      size_t            evicted;
+
+      uint64_t          evictions;
+      uint64_t          restores;
+   };
+
+   class TextureResidency; extern TextureResidency texture_residency;
+
+   /*
+      Keeps the VRAM used by textures under a budget.  The renderer reports
+      every texture it creates or deletes and every bind, which keeps the
+      textures in least recently bound order.  When the resident bytes go
+      over the budget, the least recently bound textures that have a source
+      are deleted, which also empties their texture units.  Binding an
+      evicted texture loads it again from its source before the bind goes
+      through, shaders do that on their next Use().
+
+      Textures without a source, like render targets and atlases, count
+      towards the budget but never get evicted.  Only used on the GL thread.
+   */
+   class TextureResidency
+   {
+      private:
+         struct entry_t
+         {
+            size_t                                 bytes;
+            bool                                   resident;
+            texture_source_t                       source;
+
+            std::list<wcl::string>::iterator       lru;
+         };
+
+         std::unordered_map<wcl::string, entry_t>  entries;
+
+         // The entries by the slot of their texture handle, null where there is none
+         std::vector<entry_t*>                     by_slot;
+
+         // Most recently bound first
+         std::list<wcl::string>                    lru;
+
+         size_t                                    budget;
+         size_t                                    resident_bytes;
+         uint64_t                                  evictions;
+         uint64_t                                  restores;
+
+         // Set while an eviction deletes a texture, so Released() keeps its entry
+         bool                                      evicting;
+
+         entry_t&          Track(const wcl::string& texture);
+         void              Evict(const wcl::string& texture, entry_t& entry);
+
+      public:
+         // Called by the renderer
+         void              Created(const wcl::string& texture, size_t bytes);
+         void              Released(const wcl::string& texture);
+
+         // Moves the texture to the front, and restores it if it was evicted.  False if it can't be bound
+         bool              Touch(const wcl::string& texture);
+         bool              Touch(texture_handle_t texture);
+
+         // Makes the texture evictable, source has to recreate it the same way
+         void              SetSource(const wcl::string& texture, const texture_source_t& source);
+
+         // Evicts until the resident bytes fit the budget, except keep
+         void              Enforce(const wcl::string& keep = "");
+
+         // 0 turns the budget off.  Lowering it evicts right away
+         void              SetBudget(size_t bytes);
+
+         bool              IsResident(const wcl::string& texture) const;
+         residency_stats_t Stats() const;
+
+         TextureResidency(size_t budget = 0)
+            : budget(budget), resident_bytes(0), evictions(0), restores(0), evicting(false) {}
+   };
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define YAM_SHADER
 
 #include "common.h"
+#include "registry.h"
 
 namespace yam
 {
@@ -113,8 +114,21 @@ namespace yam
          // currently used program
          static int program_in_use;
 
-         // Maps textures to uniforms
-         std::unordered_map<wcl::string, wcl::string> bound_textures;
+         // Textures bound to sampler uniforms on every Use(), the location is looked up on the first one
+         struct texture_binding_t
+         {
+            texture_handle_t  texture;
+            wcl::string       uniform;
+            GLint             location;
+         };
+
+         std::vector<texture_binding_t> bound_textures;
+
+         // Of the target_size uniform sprite shaders have, looked up on the first use
+         GLint target_size_location;
+
+         // A texture unit with texture in it, bound to it if it wasn't
+         int32_t texture_unit_for(texture_handle_t texture, const wcl::string& uniform);
 
       public:
          // status flags
@@ -122,7 +136,7 @@ namespace yam
          constexpr static uint32_t COMPILED  = 0x02;
          constexpr static uint32_t LINKED    = 0x04;
 
-         Shader() : status(YAM_CLEAR_FLAGS), texture_type(NO_TEXTURE) {};
+         Shader() : status(YAM_CLEAR_FLAGS), texture_type(NO_TEXTURE), target_size_location(-1) {};
          Shader(const wcl::string& vert, const wcl::string& frag, uint32_t t_type = NO_TEXTURE);
 
          Shader(Shader&& other);
@@ -143,6 +157,17 @@ namespace yam
 
          static const int CurrentProgram() { return program_in_use; }
 
+         // The next Use() binds its program and textures again, for when a texture unit was emptied under it
+         static void Invalidate() { program_in_use = 0; }
+
+         inline GLint TargetSizeLocation()
+         {
+            if (target_size_location < 0)
+               target_size_location = glGetUniformLocation(program, "target_size");
+
+            return target_size_location;
+         }
+
          inline wheel::flags_t Status() { return status; }
 
          // Reload the shader
@@ -0,0 +1,63 @@
+#ifndef YAM_STREAM_BUFFER_H
+#define YAM_STREAM_BUFFER_H
+
+#include "common.h"
+
+namespace yam
+{
+   /*
+      Per-frame streaming storage for data the GPU reads once, like the
+      vertices of a frame.  With ARB_buffer_storage it's one buffer mapped
+      for good, split into a region per frame in flight.  NextFrame()
+      fences the region that was written and moves on to the next one,
+      waiting only if the GPU is still reading it from frames ago.  Map()
+      then hands out pointers straight into the region.
+
+      Without buffer storage the buffer gets orphaned at the start of every
+      frame and each Map() maps a range of it unsynchronized.  Either way
+      Unmap() has to come before drawing from what was written.
+
+      A frame that needs more than a region gets a new buffer of twice the
+      size, the old one lives on in the driver until the GPU is done with
+      it.  Needs the GL context, the buffer is created on the first Map().
+   */
+   class StreamBuffer
+   {
+      private:
+         GLenum                  target;
+         GLuint                  buffer;
+
+         // The persistent mapping, null with the orphaning fallback
+         uint8_t*                mapping;
+         bool                    mapped;
+
+         size_t                  region_size;
+         uint32_t                region_count;
+         uint32_t                region;
+         size_t                  used;
+
+         std::vector<GLsync>     fences;
+
+         uint32_t                Create(size_t size);
+
+      public:
+         // Room for bytes in this frame's region, offset is where it starts in Buffer()
+         uint8_t*                Map(size_t bytes, size_t* offset);
+         void                    Unmap();
+
+         // Call once per frame, after the last draw that reads it
+         void                    NextFrame();
+
+         GLuint                  Buffer() const { return buffer; }
+         bool                    Persistent() const { return mapping != nullptr; }
+         size_t                  RegionSize() const { return region_size; }
+
+         void                    Destroy();
+
+         StreamBuffer(GLenum target = GL_ARRAY_BUFFER, size_t region_size = 1 << 20, uint32_t regions = 3)
+            : target(target), buffer(0), mapping(nullptr), mapped(false), region_size(region_size),
+              region_count(std::max(1u, regions)), region(0), used(0) {}
+   };
+}
+
+#endif
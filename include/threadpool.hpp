@@ -0,0 +1,108 @@
+#ifndef YAM_THREADPOOL_HPP
+#define YAM_THREADPOOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace yam
+{
+   /*
+      Fixed set of worker threads running queued jobs in submission order.
+      The workers are started on the first Submit(), so a pool that never
+      gets any work never creates any threads.
+   */
+   class ThreadPool
+   {
+      private:
+         std::vector<std::thread>            workers;
+         std::deque<std::function<void()>>   jobs;
+
+         std::mutex                          lock;
+         std::condition_variable             job_ready;
+         std::condition_variable             job_done;
+
+         uint32_t                            thread_count;
+         uint32_t                            running;
+         bool                                stopping;
+
+         void Work()
+         {
+            std::unique_lock<std::mutex> guard(lock);
+
+            while (true)
+            {
+               job_ready.wait(guard, [this]() { return stopping || !jobs.empty(); });
+
+               if (jobs.empty())
+                  return;
+
+               std::function<void()> job = std::move(jobs.front());
+               jobs.pop_front();
+               running++;
+
+               guard.unlock();
+               job();
+               guard.lock();
+
+               running--;
+
+               if (jobs.empty() && (running == 0))
+                  job_done.notify_all();
+            }
+         }
+
+      public:
+         // 0 threads means one per core
+         ThreadPool(uint32_t threads = 0) : thread_count(threads), running(0), stopping(false)
+         {
+            if (thread_count == 0)
+               thread_count = std::max(1u, std::thread::hardware_concurrency());
+         }
+
+        ~ThreadPool()
+         {
+            {
+               std::lock_guard<std::mutex> guard(lock);
+               stopping = true;
+            }
+
+            job_ready.notify_all();
+
+            for (auto& worker : workers)
+               worker.join();
+         }
+
+         uint32_t Size() const { return thread_count; }
+
+         void Submit(std::function<void()> job)
+         {
+            {
+               std::lock_guard<std::mutex> guard(lock);
+
+               if (workers.empty())
+               {
+                  for (uint32_t i = 0; i < thread_count; ++i)
+                     workers.emplace_back(&ThreadPool::Work, this);
+               }
+
+               jobs.push_back(std::move(job));
+            }
+
+            job_ready.notify_one();
+         }
+
+         // Blocks until every submitted job has finished
+         void Wait()
+         {
+            std::unique_lock<std::mutex> guard(lock);
+            job_done.wait(guard, [this]() { return jobs.empty() && (running == 0); });
+         }
+   };
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef YAM_VERTEX_FORMAT_H
+#define YAM_VERTEX_FORMAT_H
+
+#include "common.h"
+
+namespace yam
+{
+   // One attribute of an interleaved vertex, offset is from the start of the vertex
+   struct vertex_attribute_t
+   {
+      GLuint      location;
+      GLint       size;
+      GLenum      type;
+      GLboolean   normalized;
+      uint32_t    offset;
+   };
+
+   /*
+      The attribute layout of one interleaved vertex type, with a vertex
+      array object that keeps it.  The arrays are enabled and described
+      once, when the VAO is created on the first Bind(), so switching
+      between batches only changes where the VAO reads from.
+
+      With ARB_vertex_attrib_binding the attributes read from binding
+      point 0 and that's a single glBindVertexBuffer().  Without it the
+      attribute pointers are set again, but only when buffer or offset
+      change.  A divisor of 1 makes every attribute per instance.
+   */
+   class VertexFormat
+   {
+      private:
+         std::vector<vertex_attribute_t>   attributes;
+         GLsizei                           stride;
+         GLuint                            divisor;
+
+         GLuint                            vao;
+
+         // Where the VAO reads from, 0 when not known
+         GLuint                            buffer;
+         size_t                            offset;
+
+         // The VAO in use, shared by every format
+         static GLuint                     vao_in_use;
+
+         void                              Create();
+
+      public:
+         // Binds the VAO and points it at the vertices at offset in buffer
+         void                              Bind(GLuint buffer, size_t offset);
+
+         // Forgets where the VAO reads from, for when the buffer may have been replaced
+         inline void                       Reset() { buffer = 0; }
+
+         // Binds no VAO at all
+         static void                       Unbind();
+
+         void                              Destroy();
+
+         VertexFormat() : stride(0), divisor(0), vao(0), buffer(0), offset(0) {}
+         VertexFormat(GLsizei stride, GLuint divisor, std::initializer_list<vertex_attribute_t> attributes)
+            : attributes(attributes), stride(stride), divisor(divisor), vao(0), buffer(0), offset(0) {}
+   };
+}
+
+#endif
@@ -0,0 +1,132 @@
+#include "include/loader.h"
+#include "include/image/png.hpp"
+
+#include <fcntl.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace yam
+{
+   ImageLoader image_loader;
+
+   // The whole file into data, not through wcl::GetBuffer, its registry isn't safe to share with the main thread
+   static uint32_t read_file(const wcl::string& path, wcl::buffer_t& data)
+   {
+      int fd = open(path.std_str().c_str(), O_RDONLY);
+
+      if (fd < 0)
+         return WHEEL_RESOURCE_UNAVAILABLE;
+
+      struct stat info;
+
+      if ((fstat(fd, &info) != 0) || (info.st_size == 0))
+      {
+         close(fd);
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      data.resize(info.st_size);
+
+      size_t done = 0;
+
+      while (done < data.size())
+      {
+         const ssize_t got = read(fd, &data[done], data.size() - done);
+
+         if (got <= 0)
+         {
+            close(fd);
+            return WHEEL_RESOURCE_UNAVAILABLE;
+         }
+
+         done += got;
+      }
+
+      close(fd);
+
+      return WHEEL_OK;
+   }
+
+   void ImageLoader::Decode(const load_request_t& request, const load_callback_t& done)
+   {
+      decoded_t result;
+      result.texture = request.texture;
+      result.done = done;
+
+      std::ostringstream messages;
+      log.set_capture(&messages);
+
+      wcl::buffer_t png;
+
+      if (read_file(request.file, png) != WHEEL_OK)
+      {
+         log(ERROR, "Can't open image ", request.file, "\n");
+         result.result = WHEEL_RESOURCE_UNAVAILABLE;
+      } else {
+         image_t& image = result.image;
+         result.result = read_png(png, &image.width, &image.height, &image.channels, &image.image,
+                                  nullptr, IMAGE_BOTTOM_UP);
+      }
+
+      log.set_capture(nullptr);
+      result.messages = messages.str();
+
+      std::lock_guard<std::mutex> guard(lock);
+      decoded.push_back(std::move(result));
+   }
+
+   uint32_t ImageLoader::LoadTextures(const std::vector<load_request_t>& batch, const load_callback_t& done)
+   {
+      for (const load_request_t& request : batch)
+         pool.Submit([this, request, done]() { Decode(request, done); });
+
+      pending += batch.size();
+
+      log(FULL_DEBUG, "Queued ", batch.size(), " images on ", pool.Size(), " threads\n");
+
+      return WHEEL_OK;
+   }
+
+   uint32_t ImageLoader::Upload(uint32_t max_uploads)
+   {
+      if (pending == 0)
+         return 0;
+
+      std::deque<decoded_t> ready;
+
+      {
+         std::lock_guard<std::mutex> guard(lock);
+
+         if (decoded.size() <= max_uploads)
+         {
+            ready.swap(decoded);
+         } else {
+            std::move(decoded.begin(), decoded.begin() + max_uploads, std::back_inserter(ready));
+            decoded.erase(decoded.begin(), decoded.begin() + max_uploads);
+         }
+      }
+
+      for (decoded_t& entry : ready)
+      {
+         if (!entry.messages.empty())
+            std::cout << entry.messages;
+
+         if (entry.result == WHEEL_OK)
+            entry.result = renderer.CreateTexture(entry.texture, entry.image);
+
+         if (entry.done)
+            entry.done(entry.texture, entry.result);
+      }
+
+      pending -= ready.size();
+
+      return ready.size();
+   }
+
+   void ImageLoader::Finish()
+   {
+      pool.Wait();
+      Upload();
+   }
+}
@@ -0,0 +1,52 @@
+#include "include/mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace yam
+{
+   uint32_t MappedFile::Open(const wcl::string& path)
+   {
+      Close();
+
+      int fd = open(path.std_str().c_str(), O_RDONLY);
+
+      if (fd < 0)
+         return WHEEL_RESOURCE_UNAVAILABLE;
+
+      struct stat info;
+
+      if ((fstat(fd, &info) != 0) || (info.st_size == 0))
+      {
+         close(fd);
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      // The mapping keeps the file alive on its own
+      close(fd);
+
+      if (mapping == MAP_FAILED)
+      {
+         log(ERROR, "Can't map file ", path, "\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      ptr = (const uint8_t*)mapping;
+      len = info.st_size;
+
+      return WHEEL_OK;
+   }
+
+   void MappedFile::Close()
+   {
+      if (ptr != nullptr)
+         munmap((void*)ptr, len);
+
+      ptr = nullptr;
+      len = 0;
+   }
+}
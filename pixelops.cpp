@@ -0,0 +1,640 @@
+#include "include/pixelops.h"
+
+#if defined(__SSE2__)
+   #include <emmintrin.h>
+#endif
+
+namespace yam
+{
+   // 0xRRGGBBAA to bytes in memory order
+   static inline void colour_bytes(uint32_t colour, uint8_t out[4])
+   {
+      out[0] = colour >> 24;
+      out[1] = colour >> 16;
+      out[2] = colour >> 8;
+      out[3] = colour;
+   }
+
+   // 0xRRGGBBAA to the value of a 4 channel pixel loaded as a uint32_t
+   static inline uint32_t colour_word(uint32_t colour)
+   {
+      uint8_t bytes[4];
+      colour_bytes(colour, bytes);
+
+      uint32_t word;
+      memcpy(&word, bytes, 4);
+
+      return word;
+   }
+
+   static inline uint8_t mul_div_255(uint32_t a, uint32_t b)
+   {
+      uint32_t t = a * b + 128;
+      return (t + (t >> 8)) >> 8;
+   }
+
+   void replace_colour_row(uint8_t* row, size_t pixels, uint32_t channels, uint32_t from, uint32_t to)
+   {
+      if (channels == 4)
+      {
+         const uint32_t key = colour_word(from);
+         const uint32_t value = colour_word(to);
+         size_t i = 0;
+
+#if defined(__SSE2__)
+         const __m128i key4 = _mm_set1_epi32(key);
+         const __m128i value4 = _mm_set1_epi32(value);
+
+         for (; i + 4 <= pixels; i += 4)
+         {
+            __m128i* p = (__m128i*)(row + i * 4);
+            __m128i px = _mm_loadu_si128(p);
+            __m128i mask = _mm_cmpeq_epi32(px, key4);
+
+            // Most blocks of a sprite have nothing to replace, skip the store
+            if (_mm_movemask_epi8(mask) == 0)
+               continue;
+
+            _mm_storeu_si128(p, _mm_or_si128(_mm_andnot_si128(mask, px), _mm_and_si128(mask, value4)));
+         }
+#endif
+         for (; i < pixels; ++i)
+         {
+            uint32_t px;
+            memcpy(&px, row + i * 4, 4);
+
+            if (px == key)
+               memcpy(row + i * 4, &value, 4);
+         }
+
+         return;
+      }
+
+      uint8_t key[4], value[4];
+      colour_bytes(from, key);
+      colour_bytes(to, value);
+
+      for (uint8_t* end = row + pixels * channels; row < end; row += channels)
+      {
+         if (memcmp(row, key, channels) == 0)
+            memcpy(row, value, channels);
+      }
+   }
+
+   void remap_palette_row(uint8_t* row, size_t pixels, uint32_t channels,
+                          const uint32_t* from, const uint32_t* to, size_t count)
+   {
+      if (count == 0)
+         return;
+
+      if (count == 1)
+         return replace_colour_row(row, pixels, channels, from[0], to[0]);
+
+      if (channels == 4)
+      {
+         // 16 entries on the stack cover every realistic recolouring, more go to the heap
+         uint32_t local[32];
+         std::vector<uint32_t> heap;
+         uint32_t* words = local;
+
+         if (count > 16)
+         {
+            heap.resize(count * 2);
+            words = &heap[0];
+         }
+
+         for (size_t k = 0; k < count; ++k)
+         {
+            words[k * 2 + 0] = colour_word(from[k]);
+            words[k * 2 + 1] = colour_word(to[k]);
+         }
+
+         size_t i = 0;
+
+#if defined(__SSE2__)
+         for (; i + 4 <= pixels; i += 4)
+         {
+            __m128i* p = (__m128i*)(row + i * 4);
+            __m128i px = _mm_loadu_si128(p);
+            __m128i out = px;
+            __m128i any = _mm_setzero_si128();
+
+            // Walked backwards so the first matching entry is the one that sticks
+            for (size_t k = count; k-- > 0;)
+            {
+               __m128i mask = _mm_cmpeq_epi32(px, _mm_set1_epi32(words[k * 2]));
+
+               out = _mm_or_si128(_mm_andnot_si128(mask, out),
+                                  _mm_and_si128(mask, _mm_set1_epi32(words[k * 2 + 1])));
+               any = _mm_or_si128(any, mask);
+            }
+
+            if (_mm_movemask_epi8(any) != 0)
+               _mm_storeu_si128(p, out);
+         }
+#endif
+         for (; i < pixels; ++i)
+         {
+            uint32_t px;
+            memcpy(&px, row + i * 4, 4);
+
+            for (size_t k = 0; k < count; ++k)
+            {
+               if (px == words[k * 2])
+               {
+                  memcpy(row + i * 4, &words[k * 2 + 1], 4);
+                  break;
+               }
+            }
+         }
+
+         return;
+      }
+
+      for (uint8_t* end = row + pixels * channels; row < end; row += channels)
+      {
+         for (size_t k = 0; k < count; ++k)
+         {
+            uint8_t key[4];
+            colour_bytes(from[k], key);
+
+            if (memcmp(row, key, channels) == 0)
+            {
+               uint8_t value[4];
+               colour_bytes(to[k], value);
+               memcpy(row, value, channels);
+               break;
+            }
+         }
+      }
+   }
+
+   void premultiply_alpha_row(uint8_t* row, size_t pixels)
+   {
+      size_t i = 0;
+
+#if defined(__SSE2__)
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i rgb_mask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+      const __m128i alpha_one = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+      const __m128i round = _mm_set1_epi16(128);
+
+      // Two pixels per half, widened to 16 bits and multiplied by their broadcast alpha
+      auto premultiply = [&](__m128i px)
+      {
+         __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)),
+                                         _MM_SHUFFLE(3, 3, 3, 3));
+         __m128i t = _mm_mullo_epi16(px, _mm_or_si128(_mm_and_si128(a, rgb_mask), alpha_one));
+
+         t = _mm_add_epi16(t, round);
+         return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+      };
+
+      for (; i + 4 <= pixels; i += 4)
+      {
+         __m128i* p = (__m128i*)(row + i * 4);
+         __m128i px = _mm_loadu_si128(p);
+
+         __m128i lo = premultiply(_mm_unpacklo_epi8(px, zero));
+         __m128i hi = premultiply(_mm_unpackhi_epi8(px, zero));
+
+         _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+      }
+#endif
+      for (; i < pixels; ++i)
+      {
+         uint8_t* p = row + i * 4;
+
+         p[0] = mul_div_255(p[0], p[3]);
+         p[1] = mul_div_255(p[1], p[3]);
+         p[2] = mul_div_255(p[2], p[3]);
+      }
+   }
+
+   void swizzle_row(uint8_t* row, size_t pixels, const uint8_t order[4])
+   {
+      size_t i = 0;
+
+#if defined(__SSE2__)
+      // SSE2 has no byte shuffle, but the shift counts can come from registers
+      const __m128i byte_mask = _mm_set1_epi32(0xff);
+      __m128i src_shift[4], dst_shift[4];
+
+      for (size_t c = 0; c < 4; ++c)
+      {
+         src_shift[c] = _mm_cvtsi32_si128(order[c] * 8);
+         dst_shift[c] = _mm_cvtsi32_si128(c * 8);
+      }
+
+      for (; i + 4 <= pixels; i += 4)
+      {
+         __m128i* p = (__m128i*)(row + i * 4);
+         __m128i px = _mm_loadu_si128(p);
+         __m128i out = _mm_setzero_si128();
+
+         for (size_t c = 0; c < 4; ++c)
+         {
+            __m128i channel = _mm_and_si128(_mm_srl_epi32(px, src_shift[c]), byte_mask);
+            out = _mm_or_si128(out, _mm_sll_epi32(channel, dst_shift[c]));
+         }
+
+         _mm_storeu_si128(p, out);
+      }
+#endif
+      for (; i < pixels; ++i)
+      {
+         uint8_t* p = row + i * 4;
+         uint8_t px[4] = { p[0], p[1], p[2], p[3] };
+
+         p[0] = px[order[0]];
+         p[1] = px[order[1]];
+         p[2] = px[order[2]];
+         p[3] = px[order[3]];
+      }
+   }
+
+   void fill_row(uint8_t* row, size_t pixels, uint32_t channels, uint32_t colour)
+   {
+      if (pixels == 0)
+         return;
+
+      uint8_t value[4];
+      colour_bytes(colour, value);
+      memcpy(row, value, channels);
+
+      // Doubles the filled part every step, so the copying is all long memcpys
+      const size_t len = pixels * channels;
+
+      for (size_t done = channels; done < len; done *= 2)
+         memcpy(row + done, row, std::min(done, len - done));
+   }
+
+   void downsample_row(uint8_t* out, const uint8_t* row0, const uint8_t* row1,
+                       size_t width, size_t src_width, uint32_t channels)
+   {
+      size_t i = 0;
+
+#if defined(__SSE2__)
+      if ((channels == 4) && (src_width >= 2))
+      {
+         const __m128i zero = _mm_setzero_si128();
+         const __m128i two = _mm_set1_epi16(2);
+
+         // Adds the rows in 16 bits, then the neighbouring pixels in the low and high halves
+         auto box = [&](const uint8_t* a, const uint8_t* b)
+         {
+            __m128i top = _mm_loadu_si128((const __m128i*)a);
+            __m128i bottom = _mm_loadu_si128((const __m128i*)b);
+
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+
+            __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+            return _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+         };
+
+         for (; i + 4 <= width; i += 4)
+         {
+            __m128i first = box(row0 + i * 8, row1 + i * 8);
+            __m128i second = box(row0 + i * 8 + 16, row1 + i * 8 + 16);
+
+            _mm_storeu_si128((__m128i*)(out + i * 4), _mm_packus_epi16(first, second));
+         }
+      }
+#endif
+      for (; i < width; ++i)
+      {
+         const size_t x0 = i * 2 * channels;
+         const size_t x1 = std::min(i * 2 + 1, src_width - 1) * channels;
+
+         for (uint32_t c = 0; c < channels; ++c)
+            out[i * channels + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2;
+      }
+   }
+
+   // Largest value and bit offset of R, G, B and A in a 16 bit layout, A is 0 in 5_6_5
+   static inline bool packed_layout(uint32_t type, uint32_t max[4], uint32_t shift[4])
+   {
+      static const uint32_t layouts[3][8] =
+      {
+         { 31, 63, 31, 0,    11, 5, 0, 0 },
+         { 15, 15, 15, 15,   12, 8, 4, 0 },
+         { 31, 31, 31, 1,    11, 6, 1, 0 },
+      };
+
+      const uint32_t* layout;
+
+      if (type == GL_UNSIGNED_SHORT_5_6_5)
+         layout = layouts[0];
+      else if (type == GL_UNSIGNED_SHORT_4_4_4_4)
+         layout = layouts[1];
+      else if (type == GL_UNSIGNED_SHORT_5_5_5_1)
+         layout = layouts[2];
+      else
+         return false;
+
+      memcpy(max, layout, 4 * sizeof(uint32_t));
+      memcpy(shift, layout + 4, 4 * sizeof(uint32_t));
+
+      return true;
+   }
+
+   // floor((v * max + t) / 255), t of 127 rounds to the nearest step
+   static inline uint32_t quantize(uint32_t v, uint32_t max, uint32_t t)
+   {
+      uint32_t x = v * max + t;
+      return (x + 1 + (x >> 8)) >> 8;
+   }
+
+   void pack_row_16(uint16_t* out, const uint8_t* row, size_t pixels, uint32_t channels,
+                    uint32_t type, const uint16_t* thresholds)
+   {
+      uint32_t max[4], shift[4];
+
+      if (!packed_layout(type, max, shift) || (channels < 3))
+         return;
+
+      size_t i = 0;
+
+#if defined(__SSE2__)
+      if (channels == 4)
+      {
+         const __m128i byte_mask = _mm_set1_epi32(0xff);
+         const __m128i one = _mm_set1_epi16(1);
+         const __m128i round = _mm_set1_epi16(127);
+         const __m128i colour_t = thresholds
+            ? _mm_setr_epi16(thresholds[0], thresholds[1], thresholds[2], thresholds[3],
+                             thresholds[0], thresholds[1], thresholds[2], thresholds[3])
+            : round;
+
+         // Channel c of 8 pixels in 16 bit lanes
+         auto channel = [&](__m128i lo, __m128i hi, uint32_t c)
+         {
+            const __m128i count = _mm_cvtsi32_si128(c * 8);
+
+            return _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(lo, count), byte_mask),
+                                   _mm_and_si128(_mm_srl_epi32(hi, count), byte_mask));
+         };
+
+         // quantize() on 8 lanes, moved to where the channel sits in the texel
+         auto pack = [&](__m128i v, uint32_t c, __m128i t)
+         {
+            __m128i x = _mm_add_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(max[c])), t);
+            __m128i q = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+
+            return _mm_sll_epi16(q, _mm_cvtsi32_si128(shift[c]));
+         };
+
+         for (; i + 8 <= pixels; i += 8)
+         {
+            __m128i lo = _mm_loadu_si128((const __m128i*)(row + i * 4));
+            __m128i hi = _mm_loadu_si128((const __m128i*)(row + i * 4 + 16));
+
+            __m128i texels = _mm_or_si128(_mm_or_si128(pack(channel(lo, hi, 0), 0, colour_t),
+                                                       pack(channel(lo, hi, 1), 1, colour_t)),
+                                          pack(channel(lo, hi, 2), 2, colour_t));
+
+            if (max[3] != 0)
+               texels = _mm_or_si128(texels, pack(channel(lo, hi, 3), 3, round));
+
+            _mm_storeu_si128((__m128i*)(out + i), texels);
+         }
+      }
+#endif
+      for (; i < pixels; ++i)
+      {
+         const uint8_t* pixel = row + i * channels;
+         const uint32_t t = thresholds ? thresholds[i & 3] : 127;
+         const uint32_t a = (channels == 4) ? pixel[3] : 255;
+
+         out[i] = (quantize(pixel[0], max[0], t) << shift[0])
+                | (quantize(pixel[1], max[1], t) << shift[1])
+                | (quantize(pixel[2], max[2], t) << shift[2])
+                | (quantize(a, max[3], 127) << shift[3]);
+      }
+   }
+
+   static inline bool check_rgba(const image_t& img, const char* operation)
+   {
+      if (img.channels != 4)
+      {
+         log(ERROR, operation, " needs an RGBA image, got ", img.channels, " channels\n");
+         return false;
+      }
+
+      return true;
+   }
+
+   static inline bool check_channels(const image_t& img)
+   {
+      if ((img.channels == 0) || (img.channels > 4))
+      {
+         log(ERROR, "Unsupported image with ", img.channels, " channels\n");
+         return false;
+      }
+
+      return true;
+   }
+
+   static inline size_t pixel_count(const image_t& img)
+   {
+      return (size_t)img.width * img.height;
+   }
+
+   uint32_t replace_colour(image_t& img, uint32_t from, uint32_t to)
+   {
+      if (!check_channels(img))
+         return WHEEL_INVALID_FORMAT;
+
+      if (pixel_count(img) != 0)
+         replace_colour_row(&img.image[0], pixel_count(img), img.channels, from, to);
+
+      return WHEEL_OK;
+   }
+
+   uint32_t remap_palette(image_t& img, const palette_t& from, const palette_t& to)
+   {
+      if (from.size() != to.size())
+      {
+         log(ERROR, "Palette remap from ", from.size(), " to ", to.size(), " colours\n");
+         return WHEEL_INVALID_VALUE;
+      }
+
+      if (!check_channels(img))
+         return WHEEL_INVALID_FORMAT;
+
+      if ((pixel_count(img) != 0) && !from.empty())
+         remap_palette_row(&img.image[0], pixel_count(img), img.channels, &from[0], &to[0], from.size());
+
+      return WHEEL_OK;
+   }
+
+   uint32_t premultiply_alpha(image_t& img)
+   {
+      if (!check_rgba(img, "Alpha premultiply"))
+         return WHEEL_INVALID_FORMAT;
+
+      if (pixel_count(img) != 0)
+         premultiply_alpha_row(&img.image[0], pixel_count(img));
+
+      return WHEEL_OK;
+   }
+
+   uint32_t swizzle_channels(image_t& img, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+   {
+      if (!check_rgba(img, "Channel swizzle"))
+         return WHEEL_INVALID_FORMAT;
+
+      if ((r > 3) || (g > 3) || (b > 3) || (a > 3))
+         return WHEEL_INVALID_VALUE;
+
+      const uint8_t order[4] = { r, g, b, a };
+
+      if (pixel_count(img) != 0)
+         swizzle_row(&img.image[0], pixel_count(img), order);
+
+      return WHEEL_OK;
+   }
+
+   uint32_t fill_image(image_t& img, uint32_t colour)
+   {
+      if (!check_channels(img))
+         return WHEEL_INVALID_FORMAT;
+
+      if (pixel_count(img) != 0)
+         fill_row(&img.image[0], pixel_count(img), img.channels, colour);
+
+      return WHEEL_OK;
+   }
+
+   uint32_t fill_rect(image_t& img, size_t x, size_t y, size_t w, size_t h, uint32_t colour)
+   {
+      if (!check_channels(img))
+         return WHEEL_INVALID_FORMAT;
+
+      if ((x >= img.width) || (y >= img.height) || (w == 0) || (h == 0))
+         return WHEEL_OK;
+
+      w = std::min(w, img.width - x);
+      h = std::min(h, img.height - y);
+
+      const size_t stride = (size_t)img.width * img.channels;
+      uint8_t* row = &img.image[0] + stride * y + x * img.channels;
+
+      // The first row is filled once, the rest are copies of it
+      fill_row(row, w, img.channels, colour);
+
+      for (size_t j = 1; j < h; ++j)
+         memcpy(row + stride * j, row, w * img.channels);
+
+      return WHEEL_OK;
+   }
+
+   uint32_t downsample(const image_t& src, image_t& dst)
+   {
+      if (!check_channels(src))
+         return WHEEL_INVALID_FORMAT;
+
+      if ((src.width == 0) || (src.height == 0))
+         return WHEEL_INVALID_VALUE;
+
+      dst.width = std::max(1u, src.width / 2);
+      dst.height = std::max(1u, src.height / 2);
+      dst.channels = src.channels;
+      dst.image.resize((size_t)dst.width * dst.height * dst.channels);
+
+      const size_t src_stride = (size_t)src.width * src.channels;
+      const size_t dst_stride = (size_t)dst.width * dst.channels;
+
+      for (uint32_t y = 0; y < dst.height; ++y)
+      {
+         const uint8_t* row0 = &src.image[src_stride * y * 2];
+         const uint8_t* row1 = &src.image[src_stride * std::min(y * 2 + 1, src.height - 1)];
+
+         downsample_row(&dst.image[dst_stride * y], row0, row1, dst.width, src.width, src.channels);
+      }
+
+      return WHEEL_OK;
+   }
+
+   uint32_t build_mipmaps(const image_t& base, std::vector<image_t>& levels)
+   {
+      levels.resize(mip_level_count(base.width, base.height) - 1);
+
+      const image_t* previous = &base;
+
+      for (image_t& level : levels)
+      {
+         uint32_t result = downsample(*previous, level);
+
+         if (result != WHEEL_OK)
+            return result;
+
+         previous = &level;
+      }
+
+      return WHEEL_OK;
+   }
+
+   uint32_t packed_pixel_type(uint32_t storage, const uint8_t* pixels, size_t count, uint32_t channels)
+   {
+      // One and two channel textures are no bigger than 16 bits already
+      if ((channels < 3) || (channels > 4))
+         return 0;
+
+      switch (storage)
+      {
+         case TEXTURE_STORAGE_RGB565:   return GL_UNSIGNED_SHORT_5_6_5;
+         case TEXTURE_STORAGE_RGBA4444: return GL_UNSIGNED_SHORT_4_4_4_4;
+         case TEXTURE_STORAGE_RGBA5551: return GL_UNSIGNED_SHORT_5_5_5_1;
+         case TEXTURE_STORAGE_16BIT:    break;
+         default:                       return 0;
+      }
+
+      if (channels == 3)
+         return GL_UNSIGNED_SHORT_5_6_5;
+
+      bool opaque = true;
+
+      for (size_t i = 0; i < count; ++i)
+      {
+         const uint8_t a = pixels[i * 4 + 3];
+
+         if ((a != 0) && (a != 255))
+            return GL_UNSIGNED_SHORT_4_4_4_4;
+
+         opaque &= (a == 255);
+      }
+
+      return opaque ? GL_UNSIGNED_SHORT_5_6_5 : GL_UNSIGNED_SHORT_5_5_5_1;
+   }
+
+   uint32_t pack_pixels_16(const uint8_t* pixels, uint32_t w, uint32_t h, uint32_t channels,
+                           uint32_t type, bool dither, wcl::buffer_t& output)
+   {
+      // 4x4 Bayer matrix as thresholds out of 255
+      static const uint16_t bayer[4][4] =
+      {
+         {   8, 136,  40, 168 },
+         { 200,  72, 232, 104 },
+         {  56, 184,  24, 152 },
+         { 248, 120, 216,  88 },
+      };
+
+      if (!is_packed_type(type) || (channels < 3) || (channels > 4))
+      {
+         log(ERROR, "Can't pack ", channels, " channel pixels into pixel type ", type, "\n");
+         return WHEEL_INVALID_FORMAT;
+      }
+
+      output.resize((size_t)w * h * 2);
+
+      for (uint32_t y = 0; y < h; ++y)
+      {
+         pack_row_16((uint16_t*)&output[(size_t)y * w * 2], pixels + (size_t)y * w * channels, w,
+                     channels, type, dither ? bayer[y & 3] : nullptr);
+      }
+
+      return WHEEL_OK;
+   }
+}
@@ -1,4 +1,5 @@
 #include "include/renderer.h"
+#include "include/pixelops.h"
 
 namespace yam
 {
@@ -55,9 +56,23 @@ namespace yam
 
       glViewport(0.0, 0.0, w, h);
 
-      GLuint VertexArrayID;
-      glGenVertexArrays(1, &VertexArrayID);
-      glBindVertexArray(VertexArrayID);
+      // The attribute locations the shaders declare
+      vertex_format = VertexFormat(sizeof(vertex_t), 0,
+      {
+         { 0, 2, GL_FLOAT,          GL_FALSE, offsetof(vertex_t, x0) },
+         { 1, 2, GL_UNSIGNED_SHORT, GL_TRUE,  offsetof(vertex_t, s0) },
+         { 2, 4, GL_UNSIGNED_BYTE,  GL_TRUE,  offsetof(vertex_t, r) },
+      });
+
+      sprite_format = VertexFormat(sizeof(sprite_instance_t), 1,
+      {
+         { 3, 2, GL_FLOAT,          GL_FALSE, offsetof(sprite_instance_t, x) },
+         { 4, 2, GL_UNSIGNED_SHORT, GL_FALSE, offsetof(sprite_instance_t, w) },
+         { 5, 2, GL_SHORT,          GL_FALSE, offsetof(sprite_instance_t, pivot_x) },
+         { 6, 1, GL_FLOAT,          GL_FALSE, offsetof(sprite_instance_t, angle) },
+         { 7, 4, GL_UNSIGNED_SHORT, GL_TRUE,  offsetof(sprite_instance_t, s0) },
+         { 8, 4, GL_UNSIGNED_BYTE,  GL_TRUE,  offsetof(sprite_instance_t, r) },
+      });
 
       //glGenBuffers(1, &rbuffer_vbo);
 
@@ -96,6 +111,22 @@ namespace yam
    {
       alive = false;
 
+      if (pixel_buffer != 0)
+         glDeleteBuffers(1, &pixel_buffer);
+
+      vertex_stream.Destroy();
+
+      vertex_format.Destroy();
+      sprite_format.Destroy();
+
+      if (quad_indices != 0)
+         glDeleteBuffers(1, &quad_indices);
+
+      quad_indices = 0;
+      quad_capacity = 0;
+
+      pixel_buffer = 0;
+
       if (context != nullptr)
          SDL_GL_DeleteContext(context);
    }
@@ -130,7 +161,7 @@ namespace yam
             return YAM_SHADER_COMPILE_ERROR;
          }
       }
-      shaderlist.insert(std::make_pair(name, std::move(shader)));
+      shaders.Insert(name, std::move(shader));
 
       yam::log(yam::SUCCESS, "Added new shader: '", name, "'\n");
 
@@ -139,13 +170,20 @@ namespace yam
 
    uint32_t Renderer::UseShader(const wcl::string& name)
    {
-      if (shaderlist.count(name) != 1)
+      return UseShader(shaders.Acquire(name));
+   }
+
+   uint32_t Renderer::UseShader(shader_handle_t shader)
+   {
+      Shader* found = shaders.Get(shader);
+
+      if (found == nullptr)
       {
-         yam::log(yam::ERROR, "Cannot use shader '", name, "', it doesn't exist.\n");
+         yam::log(yam::ERROR, "Cannot use shader '", shaders.Name(shader), "', it doesn't exist.\n");
          return WHEEL_RESOURCE_UNAVAILABLE;
       }
 
-      shaderlist[name].Use();
+      found->Use();
 
 //      yam::log(yam::NOTE, "Switching to shader ", name, "\n");
 
@@ -154,75 +192,173 @@ namespace yam
 
    void Renderer::SetShader(const wcl::string& name)
    {
-      if (shaderlist.count(name) != 1)
+      const shader_handle_t shader = shaders.Acquire(name);
+
+      if (shaders.Get(shader) == nullptr)
          yam::log(yam::WARNING, "Shader '", name, "' requested before it is loaded.\n");
 
-      current_shader = name;
+      SetShader(shader);
+   }
+
+   void Renderer::SetShader(shader_handle_t shader)
+   {
+      current_shader = shader;
+      current_program = shader ? shader.index + 1 : 0;
    }
 
 
    void Renderer::AddVertex(vertex_t vertex, uint32_t z_order, GLenum etype)
    {
-      wheel::buffer_t& cbuf = select_buffer(z_order, current_shader, etype).vertex_data;
+      draw_queue.Add(draw_key(z_order, current_program, etype), vertex);
+   }
+
+   void Renderer::reserve_quad_indices(uint32_t quads)
+   {
+      if (quad_indices == 0)
+         glGenBuffers(1, &quad_indices);
+
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad_indices);
+
+      if (quads <= quad_capacity)
+         return;
+
+      quad_capacity = std::max(quads, quad_capacity * 2);
 
-      cbuf.write<float>(vertex.x0);
-      cbuf.write<float>(vertex.y0);
+      // 16 bit indices as long as every vertex of a batch fits them
+      const bool wide = ((size_t)quad_capacity * 4 > 0x10000);
+      quad_index_type = wide ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
 
-      cbuf.write<uint16_t>(vertex.s0);
-      cbuf.write<uint16_t>(vertex.t0);
+      std::vector<uint32_t> indices((size_t)quad_capacity * 6);
 
-      cbuf.write<uint8_t>(vertex.r);
-      cbuf.write<uint8_t>(vertex.g);
-      cbuf.write<uint8_t>(vertex.b);
-      cbuf.write<uint8_t>(vertex.a);
+      for (uint32_t quad = 0; quad < quad_capacity; ++quad)
+      {
+         const uint32_t v = quad * 4;
+         uint32_t* out = &indices[(size_t)quad * 6];
+
+         out[0] = v;
+         out[1] = v + 1;
+         out[2] = v + 3;
+         out[3] = v + 1;
+         out[4] = v + 2;
+         out[5] = v + 3;
+      }
+
+      if (wide)
+      {
+         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * 4, &indices[0], GL_STATIC_DRAW);
+      } else {
+         std::vector<uint16_t> narrow(indices.begin(), indices.end());
+         glBufferData(GL_ELEMENT_ARRAY_BUFFER, narrow.size() * 2, &narrow[0], GL_STATIC_DRAW);
+      }
    }
 
    void Renderer::Flush()
    {
-      static wcl::string cs = "______do___not____use____";
-      for (auto& buf : buffers)
+      if (draw_queue.Empty() && sprite_queue.Empty())
+         return;
+
+      // The sorted vertices and sprites go straight into this frame's region of the stream buffer
+      const size_t vertex_bytes = draw_queue.Size() * sizeof(vertex_t);
+      const size_t sprite_bytes = sprite_queue.Size() * sizeof(sprite_instance_t);
+
+      size_t offset;
+      uint8_t* mapped = vertex_stream.Map(vertex_bytes + sprite_bytes, &offset);
+
+      if (mapped == nullptr)
       {
-         if (cs != buf.first.shader)
-         {
-            if (UseShader(buf.first.shader))
-               continue;
+         draw_queue.Clear();
+         sprite_queue.Clear();
+         return;
+      }
 
-            cs = buf.first.shader;
-         }
+      draw_queue.Sort((vertex_t*)mapped);
+      sprite_queue.Sort((sprite_instance_t*)(mapped + vertex_bytes));
+      vertex_stream.Unmap();
+
+      // The stream buffer may have been replaced since the last frame
+      const GLuint buffer = vertex_stream.Buffer();
 
-         size_t rsize = buf.second.vertex_data.size();
+      vertex_format.Reset();
+      sprite_format.Reset();
 
-         glBindBuffer(GL_ARRAY_BUFFER, buf.second.vbo);
-         glBufferData(GL_ARRAY_BUFFER, rsize, &buf.second.vertex_data[0], GL_DYNAMIC_DRAW);
+      const std::vector<draw_command_t>& batches = draw_queue.Batches();
+      const std::vector<draw_command_t>& sprites = sprite_queue.Batches();
 
-         glEnableVertexAttribArray(0);
-         glEnableVertexAttribArray(1);
-         glEnableVertexAttribArray(2);
+      uint32_t quads = 0;
 
-         glBindBuffer(GL_ARRAY_BUFFER, buf.second.vbo);
+      for (const draw_command_t& batch : batches)
+      {
+         if (draw_key_primitive(batch.key) == DRAW_QUADS)
+            quads = std::max(quads, batch.count / 4);
+      }
+
+      // Quad batches need the attributes to start at their first vertex, the shared indices start at 0
+      uint32_t base = 0;
+      vertex_format.Bind(buffer, offset);
+
+      if (quads != 0)
+         reserve_quad_indices(quads);
 
-         glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
-                               sizeof(vertex_t),
-                               (void*)0
-                              );
-         glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE,
-                               sizeof(vertex_t),
-                               (void*)(2*sizeof(float))
-                              );
-         glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,
-                               sizeof(vertex_t),
-                               (void*)(3*sizeof(float))
-                              );
+      uint32_t program = ~0u;
+      uint32_t sized_program = ~0u;
+      Shader* shader = nullptr;
 
-         glDrawArrays(buf.first.array_type, 0, rsize / sizeof(vertex_t));
+      size_t next_batch = 0, next_sprites = 0;
 
-         glDisableVertexAttribArray(2);
-         glDisableVertexAttribArray(1);
-         glDisableVertexAttribArray(0);
+      // Both lists are in key order, merging them keeps the layers right between vertices and sprites
+      while ((next_batch < batches.size()) || (next_sprites < sprites.size()))
+      {
+         const bool is_sprites = (next_batch == batches.size())
+                              || ((next_sprites < sprites.size()) && (sprites[next_sprites].key < batches[next_batch].key));
+
+         const draw_command_t& batch = is_sprites ? sprites[next_sprites++] : batches[next_batch++];
+
+         if (program != draw_key_program(batch.key))
+         {
+            // The key has the slot of the shader, which stays the same while it's reloaded
+            shader = shaders.At(draw_key_program(batch.key) - 1);
 
-         buf.second.vertex_data.clear();
-         buf.second.vertex_data.seek(0);
+            if (shader == nullptr)
+            {
+               log(ERROR, "Skipping draws with a shader that isn't loaded\n");
+
+               // The next batch has to look its shader up again
+               program = ~0u;
+               continue;
+            }
+
+            shader->Use();
+
+            program = draw_key_program(batch.key);
+         }
+
+         if (is_sprites)
+         {
+            // Sprite shaders turn pixels into clip space themselves
+            if (sized_program != program)
+            {
+               glUniform2f(shader->TargetSizeLocation(), (float)GetTargetWidth(), (float)GetTargetHeight());
+               sized_program = program;
+            }
+
+            sprite_format.Bind(buffer, offset + vertex_bytes + (size_t)batch.first * sizeof(sprite_instance_t));
+
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, batch.count);
+         } else if (draw_key_primitive(batch.key) == DRAW_QUADS) {
+            base = batch.first;
+            vertex_format.Bind(buffer, offset + (size_t)base * sizeof(vertex_t));
+
+            glDrawElements(GL_TRIANGLES, batch.count / 4 * 6, quad_index_type, (void*)0);
+         } else {
+            // Batches come in vertex order, so base is never past batch.first
+            vertex_format.Bind(buffer, offset + (size_t)base * sizeof(vertex_t));
+
+            glDrawArrays(draw_key_primitive(batch.key), batch.first - base, batch.count);
+         }
       }
+
+      draw_queue.Clear();
+      sprite_queue.Clear();
    }
 
    uint32_t Renderer::CreateTarget(const wcl::string& name,
@@ -255,7 +391,7 @@ namespace yam
 
       for (int i = 0; i < mrt_level; ++i)
       {
-         glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, texture[name + "_color" + i].id, 0);
+         glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, textures.Get(name + "_color" + i)->id, 0);
          drawbuffers[i] = GL_COLOR_ATTACHMENT0 + i;
       }
 
@@ -272,7 +408,7 @@ namespace yam
 
       log(SUCCESS, "Created render target '", name, "'\n");
 
-      target[name] = rtarget;
+      targets.Insert(name, std::move(rtarget));
       RebindActiveTarget();
 
       return WHEEL_OK;
@@ -280,19 +416,26 @@ namespace yam
 
    void Renderer::SetTarget(const wcl::string& name)
    {
-      if ((target.count(name) == 0) && (name != ""))
+      SetTarget((name != "") ? targets.Acquire(name) : target_handle_t());
+   }
+
+   void Renderer::SetTarget(target_handle_t target)
+   {
+      const rendertarget_t* rtarget = targets.Get(target);
+
+      if (target && (rtarget == nullptr))
       {
-         log(ERROR, "Asking for non-existant render target '",name,"'");
+         log(ERROR, "Asking for non-existant render target '",targets.Name(target),"'");
          return;
       }
 
       Flush();
 
-      current_target = name;
-      if (name != "")
+      current_target = target;
+      if (rtarget != nullptr)
       {
-         glViewport(0.0, 0.0, target[current_target].w, target[current_target].h);
-         glBindFramebuffer(GL_FRAMEBUFFER, target[current_target].id);
+         glViewport(0.0, 0.0, rtarget->w, rtarget->h);
+         glBindFramebuffer(GL_FRAMEBUFFER, rtarget->id);
       }
       else
       {
@@ -301,10 +444,79 @@ namespace yam
       }
    }
 
+   // The sized internal format for 8 bit channels or one of the 16 bit layouts
+   static GLenum texture_internal_format(uint32_t channels, uint32_t format)
+   {
+      if (format == GL_UNSIGNED_SHORT_5_6_5)
+         return (GLEW_VERSION_4_1 || GLEW_ARB_ES2_compatibility) ? GL_RGB565 : GL_RGB5;
+      if (format == GL_UNSIGNED_SHORT_4_4_4_4)
+         return GL_RGBA4;
+      if (format == GL_UNSIGNED_SHORT_5_5_5_1)
+         return GL_RGB5_A1;
+
+      switch (channels)
+      {
+         case 1:  return GL_RED;
+         case 2:  return GL_RG;
+         case 3:  return GL_RGB;
+         case 4:  return GL_RGBA8;
+      }
+
+      return 0;
+   }
+
+   // VRAM a texture takes with all of its levels, as far as the driver tells
+   static size_t texture_bytes(const texture_t& tex)
+   {
+      size_t texel_bytes = tex.channels;
+      size_t block_bytes = 0;
+
+      if ((tex.format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) || (tex.format == GL_COMPRESSED_RED_RGTC1))
+         block_bytes = 8;
+      else if (tex.format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+         block_bytes = 16;
+      else if (is_packed_type(tex.format))
+         texel_bytes = 2;
+      else if (tex.format == GL_FLOAT)
+         texel_bytes = tex.channels * 4;
+
+      size_t bytes = 0;
+
+      for (uint32_t level = 0; level < tex.levels; ++level)
+      {
+         const size_t lw = std::max(1u, tex.w >> level);
+         const size_t lh = std::max(1u, tex.h >> level);
+
+         if (block_bytes != 0)
+            bytes += ((lw + 3) / 4) * ((lh + 3) / 4) * block_bytes;
+         else
+            bytes += lw * lh * texel_bytes;
+      }
+
+      return bytes;
+   }
+
+   void Renderer::apply_texture_params(const texture_t& tex)
+   {
+      const bool linear = (tex.params.filter == TEXTURE_FILTER_LINEAR);
+      GLenum min_filter = linear ? GL_LINEAR : GL_NEAREST;
+
+      if (tex.levels > 1)
+         min_filter = linear ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST_MIPMAP_NEAREST;
+
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tex.levels - 1);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, tex.params.wrap);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, tex.params.wrap);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, linear ? GL_LINEAR : GL_NEAREST);
+   }
+
    uint32_t Renderer::CreateTexture(const wcl::string& name,
                                     uint32_t w, uint32_t h,
                                     uint32_t channels,
-                                    uint32_t format)
+                                    uint32_t format,
+                                    const texture_params_t& params)
    {
       texture_t ntex;
 
@@ -312,98 +524,107 @@ namespace yam
       ntex.w = w; ntex.h = h;
       ntex.channels = channels;
       ntex.format = format;
+      ntex.params = params;
+      ntex.levels = (params.mipmaps == TEXTURE_MIPMAPS_NONE) ? 1 : mip_level_count(w, h);
 
       glBindTexture(GL_TEXTURE_2D, ntex.id);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      apply_texture_params(ntex);
 
       glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-      if (channels == 1)
-         glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, w, h, 0, GL_RED, format, (void*)0);
-      else if (channels == 2)
-         glTexImage2D(GL_TEXTURE_2D, 0, GL_RG, w, h, 0, GL_RG, format, (void*)0);
-      else if (channels == 3)
-         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, format, (void*)0);
-      else if (channels == 4)
-         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, format, (void*)0);
+      static const GLenum pixel_formats[5] = { 0, GL_RED, GL_RG, GL_RGB, GL_RGBA };
+      const GLenum internal_format = texture_internal_format(channels, format);
+
+      for (uint32_t level = 0; (internal_format != 0) && (level < ntex.levels); ++level)
+      {
+         const uint32_t lw = std::max(1u, w >> level);
+         const uint32_t lh = std::max(1u, h >> level);
 
-      texture[name] = ntex;
+         glTexImage2D(GL_TEXTURE_2D, level, internal_format, lw, lh, 0, pixel_formats[channels], format, (void*)0);
+      }
+
+      const size_t bytes = texture_bytes(ntex);
+
+      textures.Insert(name, std::move(ntex));
       RebindActiveTexture();
 
+      texture_residency.Created(name, bytes);
+
       return WHEEL_OK;
    }
 
-   uint32_t Renderer::CreateTexture(const wcl::string& name, image_t& image)
+   uint32_t Renderer::CreateTexture(const wcl::string& name, image_t& image, const texture_params_t& params)
    {
-      texture_t ntex;
-
-      glGenTextures(1, &ntex.id);
-      ntex.w = image.width;
-      ntex.h = image.height;
-      ntex.channels = image.channels;
-      ntex.format = WHEEL_UNSIGNED_BYTE;
+      const uint32_t packed = packed_pixel_type(params.storage, image.image.data(),
+                                                (size_t)image.width * image.height, image.channels);
 
-      glBindTexture(GL_TEXTURE_2D, ntex.id);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      uint32_t result = (packed != 0)
+         ? CreateTexture(name, image.width, image.height, packed_channels(packed), packed, params)
+         : CreateTexture(name, image.width, image.height, image.channels, WHEEL_UNSIGNED_BYTE, params);
 
-      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      if (result == WHEEL_OK)
+         result = UploadTexturePixels(name, &image.image[0], image.width, image.height, image.channels);
 
-      if (image.channels == 1)
-         glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, ntex.w, ntex.h, 0, GL_RED, ntex.format, (void*)(&image.image[0]));
-      else if (image.channels == 2)
-         glTexImage2D(GL_TEXTURE_2D, 0, GL_RG, ntex.w, ntex.h, 0, GL_RG, ntex.format, (void*)(&image.image[0]));
-      else if (image.channels == 3)
-         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, ntex.w, ntex.h, 0, GL_RGB, ntex.format, (void*)(&image.image[0]));
-      else if (image.channels == 4)
-         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, ntex.w, ntex.h, 0, GL_RGBA, ntex.format, (void*)(&image.image[0]));
+      if (result != WHEEL_OK)
+         return result;
 
-      texture[name] = ntex;
+      if (params.mipmaps == TEXTURE_MIPMAPS_CPU)
+      {
+         std::vector<image_t> levels;
+         result = build_mipmaps(image, levels);
 
-      RebindActiveTexture();
+         for (size_t i = 0; (result == WHEEL_OK) && (i < levels.size()); ++i)
+         {
+            result = UploadTexturePixels(name, &levels[i].image[0], levels[i].width, levels[i].height,
+                                         levels[i].channels, i + 1);
+         }
+      } else if (params.mipmaps == TEXTURE_MIPMAPS_GPU) {
+         result = GenerateMipmaps(name);
+      }
 
-      return WHEEL_OK;
+      return result;
    }
 
 
    uint32_t Renderer::UploadTextureData(const wcl::string& name,
                                         int32_t xoff, int32_t yoff,
                                         uint32_t w, uint32_t h,
-                                        void* pixel_data)
+                                        void* pixel_data, uint32_t level)
+   {
+      return UploadTextureData(textures.Acquire(name), xoff, yoff, w, h, pixel_data, level);
+   }
+
+   uint32_t Renderer::UploadTextureData(texture_handle_t texture,
+                                        int32_t xoff, int32_t yoff,
+                                        uint32_t w, uint32_t h,
+                                        void* pixel_data, uint32_t level)
    {
-      if (!texture.count(name))
+      const texture_t* tex = textures.Get(texture);
+
+      if (tex == nullptr)
       {
-         log(ERROR, "Can't upload texture data to texture ", name, ", it doesn't exist.\n");
+         log(ERROR, "Can't upload texture data to texture ", textures.Name(texture), ", it doesn't exist.\n");
          return WHEEL_RESOURCE_UNAVAILABLE;
       }
 
-      glBindTexture(GL_TEXTURE_2D, texture[name].id);
+      glBindTexture(GL_TEXTURE_2D, tex->id);
 
-      if (texture[name].channels == 1)
-         glTexSubImage2D(GL_TEXTURE_2D, 0, xoff, yoff, w, h, GL_RED, texture[name].format, pixel_data);
-      else if (texture[name].channels == 2)
-         glTexSubImage2D(GL_TEXTURE_2D, 0, xoff, yoff, w, h, GL_RG, texture[name].format, pixel_data);
-      else if (texture[name].channels == 3)
-         glTexSubImage2D(GL_TEXTURE_2D, 0, xoff, yoff, w, h, GL_RGB, texture[name].format, pixel_data);
-      else if (texture[name].channels == 4)
-         glTexSubImage2D(GL_TEXTURE_2D, 0, xoff, yoff, w, h, GL_RGBA, texture[name].format, pixel_data);
+      if (tex->channels == 1)
+         glTexSubImage2D(GL_TEXTURE_2D, level, xoff, yoff, w, h, GL_RED, tex->format, pixel_data);
+      else if (tex->channels == 2)
+         glTexSubImage2D(GL_TEXTURE_2D, level, xoff, yoff, w, h, GL_RG, tex->format, pixel_data);
+      else if (tex->channels == 3)
+         glTexSubImage2D(GL_TEXTURE_2D, level, xoff, yoff, w, h, GL_RGB, tex->format, pixel_data);
+      else if (tex->channels == 4)
+         glTexSubImage2D(GL_TEXTURE_2D, level, xoff, yoff, w, h, GL_RGBA, tex->format, pixel_data);
       else
       {
-         if (name != texture_unit[texture_unit.get_active_id()].current())
+         if (texture != texture_unit[texture_unit.get_active_id()].current())
             RebindActiveTexture();
          return 666;
       }
 
-      if (name != texture_unit[texture_unit.get_active_id()].current())
+      if (texture != texture_unit[texture_unit.get_active_id()].current())
          RebindActiveTexture();
 
       return WHEEL_OK;
@@ -414,34 +635,255 @@ namespace yam
       return UploadTextureData(name, 0, 0, image.width, image.height, (void*)(&image.image[0]));
    }
 
+   uint32_t Renderer::UploadTexturePixels(const wcl::string& name, const uint8_t* pixels,
+                                          uint32_t w, uint32_t h, uint32_t channels, uint32_t level)
+   {
+      return UploadTexturePixels(textures.Acquire(name), pixels, w, h, channels, level);
+   }
+
+   uint32_t Renderer::UploadTexturePixels(texture_handle_t texture, const uint8_t* pixels,
+                                          uint32_t w, uint32_t h, uint32_t channels, uint32_t level)
+   {
+      const texture_t* tex = textures.Get(texture);
+
+      if (tex == nullptr)
+      {
+         log(ERROR, "Can't upload texture data to texture ", textures.Name(texture), ", it doesn't exist.\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      if (!is_packed_type(tex->format))
+         return UploadTextureData(texture, 0, 0, w, h, (void*)pixels, level);
+
+      uint32_t result = pack_pixels_16(pixels, w, h, channels, tex->format, tex->params.dither, packed_pixels);
+
+      if (result != WHEEL_OK)
+         return result;
+
+      return UploadTextureData(texture, 0, 0, w, h, (void*)&packed_pixels[0], level);
+   }
+
    uint32_t Renderer::UpdateTexture(const wcl::string& name, image_t& image)
    {
-      if (!texture.count(name))
+      return UpdateTexture(textures.Acquire(name), image);
+   }
+
+   uint32_t Renderer::UpdateTexture(texture_handle_t texture, image_t& image)
+   {
+      const texture_t* tex = textures.Get(texture);
+
+      if (tex == nullptr)
       {
-         log(ERROR, "Can't update texture ", name, ", it doesn't exist.\n");
+         log(ERROR, "Can't update texture ", textures.Name(texture), ", it doesn't exist.\n");
          return WHEEL_RESOURCE_UNAVAILABLE;
       }
 
-      if ((image.width != texture[name].w)
-      || (image.height != texture[name].h)
-      || (image.channels != texture[name].channels)
-      || (texture[name].format != WHEEL_UNSIGNED_BYTE))
+      const bool packed = is_packed_type(tex->format);
+
+      if ((image.width != tex->w)
+      || (image.height != tex->h)
+      || (!packed && (image.channels != tex->channels))
+      || (!packed && (tex->format != WHEEL_UNSIGNED_BYTE)))
+      {
+         log(ERROR, "Cannot update mismatching texture ", textures.Name(texture), "\n");
+      }
+
+      UploadTexturePixels(texture, &image.image[0], image.width, image.height, image.channels);
+      return WHEEL_OK;
+   }
+
+   bool Renderer::SupportsCompressedFormat(uint32_t internal_format)
+   {
+      if ((internal_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+      || (internal_format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT))
+         return GLEW_EXT_texture_compression_s3tc;
+
+      // RGTC is core since GL 3.0
+      if (internal_format == GL_COMPRESSED_RED_RGTC1)
+         return GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+
+      return false;
+   }
+
+   uint32_t Renderer::CreateCompressedTexture(const wcl::string& name,
+                                              uint32_t w, uint32_t h,
+                                              uint32_t channels,
+                                              uint32_t internal_format,
+                                              const texture_params_t& params)
+   {
+      if (!SupportsCompressedFormat(internal_format))
       {
-         log(ERROR, "Cannot update mismatching texture ", name, "\n");
+         log(ERROR, "Can't create texture ", name, ", compressed format ", internal_format,
+             " is not supported\n");
+         return WHEEL_INVALID_FORMAT;
       }
 
-      UploadTextureData(name, image);
+      texture_t ntex;
+
+      glGenTextures(1, &ntex.id);
+      ntex.w = w; ntex.h = h;
+      ntex.channels = channels;
+      ntex.format = internal_format;
+      ntex.params = params;
+      ntex.levels = (params.mipmaps == TEXTURE_MIPMAPS_NONE) ? 1 : mip_level_count(w, h);
+
+      glBindTexture(GL_TEXTURE_2D, ntex.id);
+      apply_texture_params(ntex);
+
+      const size_t bytes = texture_bytes(ntex);
+
+      textures.Insert(name, std::move(ntex));
+      RebindActiveTexture();
+
+      texture_residency.Created(name, bytes);
+
       return WHEEL_OK;
    }
 
+   uint32_t Renderer::UploadCompressedTextureData(const wcl::string& name, uint32_t level,
+                                                  uint32_t w, uint32_t h,
+                                                  const void* data, size_t size)
+   {
+      const texture_handle_t texture = textures.Find(name);
+      const texture_t* tex = textures.Get(texture);
+
+      if (tex == nullptr)
+      {
+         log(ERROR, "Can't upload texture data to texture ", name, ", it doesn't exist.\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      glBindTexture(GL_TEXTURE_2D, tex->id);
+      glCompressedTexImage2D(GL_TEXTURE_2D, level, tex->format, w, h, 0, size, data);
+
+      if (texture != texture_unit[texture_unit.get_active_id()].current())
+         RebindActiveTexture();
+
+      return WHEEL_OK;
+   }
+
+   uint32_t Renderer::GenerateMipmaps(const wcl::string& name)
+   {
+      const texture_t* tex = textures.Get(name);
+
+      if (tex == nullptr)
+      {
+         log(ERROR, "Can't generate mipmaps for texture ", name, ", it doesn't exist.\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      if (tex->levels < 2)
+         return WHEEL_OK;
+
+      glBindTexture(GL_TEXTURE_2D, tex->id);
+      glGenerateMipmap(GL_TEXTURE_2D);
+
+      RebindActiveTexture();
+
+      return WHEEL_OK;
+   }
+
+   uint32_t Renderer::SetTextureParams(const wcl::string& name, const texture_params_t& params)
+   {
+      texture_t* tex = textures.Get(name);
+
+      if (tex == nullptr)
+      {
+         log(ERROR, "Can't set parameters of texture ", name, ", it doesn't exist.\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      tex->params.filter = params.filter;
+      tex->params.wrap = params.wrap;
+
+      glBindTexture(GL_TEXTURE_2D, tex->id);
+      apply_texture_params(*tex);
+
+      RebindActiveTexture();
+
+      return WHEEL_OK;
+   }
+
+   uint8_t* Renderer::MapPixelBuffer(size_t size)
+   {
+      if (pixel_buffer == 0)
+         glGenBuffers(1, &pixel_buffer);
+
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+
+      // Orphan the previous storage, so this doesn't wait for an upload still reading from it
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+
+      void* pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+      if (pixels == nullptr)
+      {
+         log(ERROR, "Can't map a pixel unpack buffer of ", size, " bytes\n");
+         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      }
+
+      return (uint8_t*)pixels;
+   }
+
+   uint32_t Renderer::CreateTextureFromPixelBuffer(const wcl::string& name,
+                                                   uint32_t w, uint32_t h,
+                                                   uint32_t components)
+   {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+
+      if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE)
+      {
+         log(ERROR, "Pixel unpack buffer for texture ", name, " got corrupted\n");
+         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+         return WHEEL_ERROR;
+      }
+
+      // With a pixel unpack buffer bound, the null data pointer is an offset into it
+      uint32_t result = CreateTexture(name, w, h, components);
+
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+      return result;
+   }
+
+   void Renderer::DiscardPixelBuffer()
+   {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+   }
+
    void Renderer::DeleteTexture(const wcl::string& name)
    {
-      if (!texture.count(name))
+      texture_residency.Released(name);
+
+      const texture_handle_t texture = textures.Find(name);
+      const texture_t* tex = textures.Get(texture);
+
+      if (tex == nullptr)
          return;
 
-      glDeleteTextures(1, &texture[name].id);
+      // Its texture unit is free again, shaders bind the texture by handle on their next Use()
+      const int32_t tu = GetTU(texture);
+
+      if (tu >= 0)
+      {
+         texture_unit[tu] = nullptr;
+         Shader::Invalidate();
+      }
+
+      glDeleteTextures(1, &tex->id);
+
+      // The name keeps its handle, whatever holds it finds the texture again once it's created or restored
+      textures.Clear(texture);
+   }
+
+   void Renderer::ForgetTexture(const wcl::string& name)
+   {
+      DeleteTexture(name);
 
-      texture.erase(name);
+      textures.Remove(textures.Find(name));
    }
 
    uint32_t Renderer::CreateAtlas(const wcl::string& name, uint32_t size,
@@ -451,7 +893,7 @@ namespace yam
 
       CreateTexture(name, size, size, channels, format);
 
-      atlas_new.texture = &texture[name];
+      atlas_new.texture = textures.Find(name);
 
       atlas_new.size = size;
       atlas_new.atlas.width = size;
@@ -459,7 +901,7 @@ namespace yam
 
       atlas_new.atlas.Reset();
 
-      atlas[name] = atlas_new;
+      atlases.Insert(name, std::move(atlas_new));
 
       return WHEEL_OK;
    }
@@ -467,29 +909,31 @@ namespace yam
    uint32_t Renderer::AtlasBuffer(const wcl::string& atlas_name, const wcl::string& sprite_name,
                                   uint32_t w, uint32_t h, void* data)
    {
-      if (atlas.count(atlas_name) == 0)
+      atlas_t* found = atlases.Get(atlas_name);
+
+      if (found == nullptr)
       {
          log(ERROR, "Can't add sprite '",sprite_name,"' to atlas '",atlas_name,"', atlas doesn't exist\n");
          return WHEEL_RESOURCE_UNAVAILABLE;
       }
 
-      if (atlas[atlas_name].stored.count(sprite_name) != 0)
+      if (found->stored.Get(sprite_name) != nullptr)
       {
          log(ERROR, "Can't add sprite '",sprite_name,"' to atlas '",atlas_name,"', name is not unique\n");
          return WHEEL_INVALID_VALUE;
       }
 
-      wheel::rect_t r = atlas[atlas_name].atlas.Fit(w, h);
+      wheel::rect_t r = found->atlas.Fit(w, h);
       if (r.w == 0)
       {
          log(ERROR, "Can't add sprite '",sprite_name,"' to atlas '",atlas_name,"', atlas is full\n");
          return WHEEL_ATLAS_FULL;
       }
 
-      atlas[atlas_name].atlas.Prune(r);
-      atlas[atlas_name].stored[sprite_name] = r;
+      found->atlas.Prune(r);
+      found->stored.Insert(sprite_name, wheel::rect_t(r));
 
-      UploadTextureData(atlas_name, r.x, r.y, r.w, r.h, data);
+      UploadTextureData(found->texture, r.x, r.y, r.w, r.h, data);
 
       return WHEEL_OK;
    }
@@ -497,30 +941,73 @@ namespace yam
    uint32_t Renderer::GetAtlasPos(const wcl::string& atlas_name, const wcl::string& sprite_name,
                                   wheel::rect_t* result)
    {
-      if (atlas.count(atlas_name) == 0)
+      const atlas_t* found = atlases.Get(atlas_name);
+
+      if (found == nullptr)
       {
          log(ERROR, "Trying to access texture atlas '", atlas_name,"' that doesn't exist.\n");
          return WHEEL_RESOURCE_UNAVAILABLE;
       }
 
-      if (atlas[atlas_name].stored.count(sprite_name) == 0)
+      const wheel::rect_t* stored = found->stored.Get(sprite_name);
+
+      if (stored == nullptr)
       {
 //       this log message causes horrible spam with fonts, since they autoload.
 //         log(WARNING, "Atlas '",atlas_name,"' doesn't have sprite '",sprite_name,"'\n");
          return WHEEL_RESOURCE_UNAVAILABLE;
       }
 
-      *result = atlas[atlas_name].stored[sprite_name];
+      *result = *stored;
 
       return WHEEL_OK;
    }
 
+   uint32_t Renderer::GetAtlasPos(atlas_handle_t atlas, sprite_handle_t sprite, wheel::rect_t* result)
+   {
+      const atlas_t* found = atlases.Get(atlas);
+
+      if (found == nullptr)
+      {
+         log(ERROR, "Trying to access texture atlas '", atlases.Name(atlas),"' that doesn't exist.\n");
+         return WHEEL_RESOURCE_UNAVAILABLE;
+      }
+
+      const wheel::rect_t* stored = found->stored.Get(sprite);
+
+      if (stored == nullptr)
+         return WHEEL_RESOURCE_UNAVAILABLE;
+
+      *result = *stored;
+
+      return WHEEL_OK;
+   }
+
+   sprite_handle_t Renderer::SpriteHandle(atlas_handle_t atlas, const wcl::string& sprite)
+   {
+      const atlas_t* found = atlases.Get(atlas);
+
+      if (found == nullptr)
+         return sprite_handle_t();
+
+      return found->stored.Find(sprite);
+   }
+
    int32_t Renderer::GetTU(const wcl::string& ident)
    {
+      return GetTU(textures.Find(ident));
+   }
+
+   int32_t Renderer::GetTU(texture_handle_t texture)
+   {
+      // Empty units have no handle either
+      if (!texture)
+         return -1;
+
       int i;
       for (i = 0; i < texture_unit.count(); ++i)
       {
-         if (texture_unit[i].current() == ident)
+         if (texture_unit[i].current() == texture)
             return i;
       }
 
@@ -0,0 +1,209 @@
+#include "include/residency.h"
+#include "include/renderer.h"
+#include "include/image_cache.h"
+
+namespace yam
+{
+   TextureResidency texture_residency;
+
+   texture_source_t cached_file_source(ImageCache& cache, const wcl::string& file,
+                                       uint32_t flags, const texture_params_t& params)
+   {
+      return [&cache, file, flags, params](const wcl::string& texture)
+      {
+         return cache.LoadTexture(texture, file, flags, params);
+      };
+   }
+
+   TextureResidency::entry_t& TextureResidency::Track(const wcl::string& texture)
+   {
+      auto found = entries.find(texture);
+
+      if (found != entries.end())
+         return found->second;
+
+      entry_t& entry = entries[texture];
+      entry.bytes = 0;
+      entry.resident = false;
+
+      // A source can come before the texture, so this makes the slot the texture gets later
+      const texture_handle_t handle = renderer.TextureHandle(texture);
+
+      if (handle.index >= by_slot.size())
+         by_slot.resize(handle.index + 1, nullptr);
+
+      by_slot[handle.index] = &entry;
+
+      return entry;
+   }
+
+   void TextureResidency::Evict(const wcl::string& texture, entry_t& entry)
+   {
+      // texture may be the string in the list, which goes away here
+      const wcl::string name = texture;
+
+      resident_bytes -= entry.bytes;
+      entry.resident = false;
+      lru.erase(entry.lru);
+      evictions++;
+
+      log(FULL_DEBUG, "Evicted texture ", name, ", ", entry.bytes, " bytes\n");
+
+      evicting = true;
+      renderer.DeleteTexture(name);
+      evicting = false;
+   }
+
+   void TextureResidency::Created(const wcl::string& texture, size_t bytes)
+   {
+      entry_t& entry = Track(texture);
+
+      if (entry.resident)
+      {
+         // Created again under the same name, it replaces the old one
+         resident_bytes -= entry.bytes;
+         lru.splice(lru.begin(), lru, entry.lru);
+      } else {
+         entry.lru = lru.insert(lru.begin(), texture);
+      }
+
+      entry.bytes = bytes;
+      entry.resident = true;
+      resident_bytes += bytes;
+
+      Enforce(texture);
+   }
+
+   void TextureResidency::Released(const wcl::string& texture)
+   {
+      if (evicting)
+         return;
+
+      auto found = entries.find(texture);
+
+      if (found == entries.end())
+         return;
+
+      if (found->second.resident)
+      {
+         resident_bytes -= found->second.bytes;
+         lru.erase(found->second.lru);
+      }
+
+      const texture_handle_t handle = renderer.FindTexture(texture);
+
+      if (handle && (handle.index < by_slot.size()))
+         by_slot[handle.index] = nullptr;
+
+      entries.erase(found);
+   }
+
+   bool TextureResidency::Touch(const wcl::string& texture)
+   {
+      auto found = entries.find(texture);
+
+      // Not something the renderer created
+      if (found == entries.end())
+         return true;
+
+      entry_t& entry = found->second;
+
+      if (entry.resident)
+      {
+         lru.splice(lru.begin(), lru, entry.lru);
+         return true;
+      }
+
+      if (!entry.source)
+         return false;
+
+      // The source creates the texture through the renderer, which calls Created()
+      const texture_source_t source = entry.source;
+
+      if ((source(texture) != WHEEL_OK) || !entry.resident)
+      {
+         log(ERROR, "Couldn't restore evicted texture ", texture, "\n");
+         return false;
+      }
+
+      restores++;
+
+      return true;
+   }
+
+   bool TextureResidency::Touch(texture_handle_t texture)
+   {
+      entry_t* entry = (texture.index < by_slot.size()) ? by_slot[texture.index] : nullptr;
+
+      // Not something the renderer created
+      if (entry == nullptr)
+         return true;
+
+      if (entry->resident)
+      {
+         lru.splice(lru.begin(), lru, entry->lru);
+         return true;
+      }
+
+      // Restores are rare, they go by name
+      return Touch(renderer.TextureName(texture));
+   }
+
+   void TextureResidency::SetSource(const wcl::string& texture, const texture_source_t& source)
+   {
+      Track(texture).source = source;
+      Enforce();
+   }
+
+   void TextureResidency::Enforce(const wcl::string& keep)
+   {
+      if (budget == 0)
+         return;
+
+      // From the least recently bound end.  Deleting a texture frees its texture unit, see Renderer::DeleteTexture
+      for (auto next = lru.end(); (resident_bytes > budget) && (next != lru.begin()); )
+      {
+         auto candidate = std::prev(next);
+         entry_t& entry = entries[*candidate];
+
+         if (entry.source && (*candidate != keep))
+            Evict(*candidate, entry);
+         else
+            next = candidate;
+      }
+   }
+
+   void TextureResidency::SetBudget(size_t bytes)
+   {
+      budget = bytes;
+      Enforce();
+   }
+
+   bool TextureResidency::IsResident(const wcl::string& texture) const
+   {
+      auto found = entries.find(texture);
+      return (found != entries.end()) && found->second.resident;
+   }
+
+   residency_stats_t TextureResidency::Stats() const
+   {
+      residency_stats_t stats;
+
+      stats.budget = budget;
+      stats.resident_bytes = resident_bytes;
+      stats.resident = lru.size();
+      stats.evicted = 0;
+
+      // Entries with only a source were never created, they don't count
+      for (const auto& entry : entries)
+      {
+         if (!entry.second.resident && (entry.second.bytes != 0))
+            stats.evicted++;
+      }
+
+      stats.evictions = evictions;
+      stats.restores = restores;
+
+      return stats;
+   }
+}
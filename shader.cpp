@@ -8,7 +8,7 @@ namespace yam
 
    // other stuff
    Shader::Shader(const wcl::string& vert, const wcl::string& frag, uint32_t ttype) :
-      vertex_file(vert), fragment_file(frag), status(HAS_FILES), texture_type(ttype)
+      vertex_file(vert), fragment_file(frag), status(HAS_FILES), texture_type(ttype), target_size_location(-1)
    {
    }
 
@@ -20,6 +20,7 @@ namespace yam
       program = other.program;
       texture_type = other.texture_type;
       bound_textures = std::move(other.bound_textures);
+      target_size_location = other.target_size_location;
 
       other.program = 0;
    }
@@ -138,6 +139,12 @@ namespace yam
 
       Compile();
 
+      // The new program has its own uniform locations
+      for (texture_binding_t& binding : bound_textures)
+         binding.location = -1;
+
+      target_size_location = -1;
+
       if (onthefly)
          Use(false);
    }
@@ -159,40 +166,57 @@ namespace yam
       if (!rebindtextures)
          return;
 
-      // TODO: Bind textures to shader here
-
-      for (auto& mat : bound_textures)
+      // This program is in use, the samplers can be set directly
+      for (texture_binding_t& binding : bound_textures)
       {
-         Bind(mat.first, mat.second);
+         const int32_t tu = texture_unit_for(binding.texture, binding.uniform);
+
+         if (binding.location < 0)
+            binding.location = glGetUniformLocation(program, binding.uniform.std_str().c_str());
+
+         glUniform1i(binding.location, tu);
       }
    }
 
-   void Shader::Bind(const wcl::string& ident, const wcl::string& uniform)
+   int32_t Shader::texture_unit_for(texture_handle_t texture, const wcl::string& uniform)
    {
       int32_t tu;
-/*
-      if (renderer.texture.count(ident) == 0)
-      {
-         log(ERROR, "Cannot bind texture '",ident,"' to uniform '",uniform,"', texture doesn't exist\n");
-         return;
-      }
-*/
-      if ((tu = renderer.GetTU(ident)) < 0)
+
+      if ((tu = renderer.GetTU(texture)) < 0)
       {
          tu = renderer.texture_unit.get_free();
          log(NOTE, "binding unused TU ", tu, " to uniform '",uniform,"'\n");
-         renderer.texture_unit[tu] = ident;
+         renderer.texture_unit[tu] = texture;
+      } else {
+         // Still counts as a use for the residency order
+         texture_residency.Touch(texture);
       }
 
-      (*this)[uniform] = tu;
+      return tu;
+   }
 
-      return;
+   void Shader::Bind(const wcl::string& ident, const wcl::string& uniform)
+   {
+      (*this)[uniform] = texture_unit_for(renderer.TextureHandle(ident), uniform);
    }
 
 
    void Shader::AddBinding(const wcl::string& ident, const wcl::string& uniform)
    {
       log(NOTE, "Add binding of texture/atlas ", ident, " to uniform ", uniform, "\n");
-      bound_textures[ident] = uniform;
+
+      const texture_handle_t texture = renderer.TextureHandle(ident);
+
+      for (texture_binding_t& binding : bound_textures)
+      {
+         if (binding.texture == texture)
+         {
+            binding.uniform = uniform;
+            binding.location = -1;
+            return;
+         }
+      }
+
+      bound_textures.push_back({ texture, uniform, -1 });
    }
 }
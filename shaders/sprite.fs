@@ -0,0 +1,14 @@
+#version 330
+precision highp float;
+
+in vec2 texcoord0;
+in vec4 ex_col;
+
+uniform sampler2D sprite_atlas;
+
+out vec4 outc;
+
+void main()
+{
+   outc = texture(sprite_atlas, texcoord0) * ex_col;
+}
@@ -0,0 +1,35 @@
+#version 330
+#extension GL_ARB_explicit_attrib_location : require
+
+// One sprite_instance_t per instance, the corners come from the vertex id
+layout(location = 3) in vec2 in_pos;
+layout(location = 4) in vec2 in_size;
+layout(location = 5) in vec2 in_pivot;
+layout(location = 6) in float in_angle;
+layout(location = 7) in vec4 in_uv;
+layout(location = 8) in vec4 in_col;
+
+out vec2 texcoord0;
+out vec4 ex_col;
+
+// Set by the renderer, pixels of the render target
+uniform vec2 target_size;
+
+void main()
+{
+   // Strip order: bottom left, bottom right, top left, top right
+   vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+
+   vec2 local = corner * in_size - in_pivot;
+
+   float c = cos(in_angle);
+   float s = sin(in_angle);
+
+   vec2 pixel = in_pos + vec2(local.x * c - local.y * s,
+                              local.x * s + local.y * c);
+
+   ex_col = in_col;
+   texcoord0 = mix(in_uv.xy, in_uv.zw, corner);
+
+   gl_Position = vec4(pixel / target_size * 2.0 - 1.0, 0.0, 1.0);
+}
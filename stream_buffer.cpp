@@ -0,0 +1,144 @@
+#include "include/stream_buffer.h"
+
+namespace yam
+{
+   uint32_t StreamBuffer::Create(size_t size)
+   {
+      region_size = (size + 255) & ~(size_t)255;
+      region = 0;
+      used = 0;
+
+      glGenBuffers(1, &buffer);
+      glBindBuffer(target, buffer);
+
+      if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage)
+      {
+         const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+         const size_t total = region_size * region_count;
+
+         glBufferStorage(target, total, nullptr, flags);
+         mapping = (uint8_t*)glMapBufferRange(target, 0, total, flags);
+
+         if (mapping != nullptr)
+         {
+            fences.assign(region_count, 0);
+            return WHEEL_OK;
+         }
+
+         // Immutable storage can't be orphaned, start over with a plain buffer
+         log(WARNING, "Can't map stream buffer persistently, orphaning it every frame instead\n");
+
+         glDeleteBuffers(1, &buffer);
+         glGenBuffers(1, &buffer);
+         glBindBuffer(target, buffer);
+      }
+
+      glBufferData(target, region_size, nullptr, GL_STREAM_DRAW);
+
+      return WHEEL_OK;
+   }
+
+   uint8_t* StreamBuffer::Map(size_t bytes, size_t* offset)
+   {
+      // Every allocation starts aligned for any vertex format
+      bytes = (bytes + 15) & ~(size_t)15;
+
+      if ((buffer == 0) || (used + bytes > region_size))
+      {
+         size_t size = std::max(region_size, bytes);
+
+         if (buffer != 0)
+         {
+            size = std::max(region_size * 2, bytes);
+            log(NOTE, "Stream buffer region of ", region_size, " bytes is too small, growing it to ", size, "\n");
+         }
+
+         Destroy();
+         Create(size);
+      }
+
+      *offset = (size_t)region * region_size + used;
+      used += bytes;
+
+      if (mapping != nullptr)
+         return mapping + *offset;
+
+      glBindBuffer(target, buffer);
+
+      // The first write of a frame orphans the storage the GPU may still be reading
+      if (*offset == 0)
+         glBufferData(target, region_size, nullptr, GL_STREAM_DRAW);
+
+      uint8_t* data = (uint8_t*)glMapBufferRange(target, *offset, bytes,
+                                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT
+                                                 | GL_MAP_UNSYNCHRONIZED_BIT);
+
+      if (data == nullptr)
+         log(ERROR, "Can't map ", bytes, " bytes of the stream buffer\n");
+
+      mapped = (data != nullptr);
+
+      return data;
+   }
+
+   void StreamBuffer::Unmap()
+   {
+      if (!mapped)
+         return;
+
+      glBindBuffer(target, buffer);
+      glUnmapBuffer(target);
+
+      mapped = false;
+   }
+
+   void StreamBuffer::NextFrame()
+   {
+      used = 0;
+
+      if (mapping == nullptr)
+         return;
+
+      fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      region = (region + 1) % region_count;
+
+      if (fences[region] == 0)
+         return;
+
+      // Only blocks when the GPU is more than region_count frames behind
+      GLenum status = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, ~(GLuint64)0);
+
+      if (status == GL_WAIT_FAILED)
+         log(ERROR, "Waiting for stream buffer region ", region, " failed\n");
+
+      glDeleteSync(fences[region]);
+      fences[region] = 0;
+   }
+
+   void StreamBuffer::Destroy()
+   {
+      if (buffer == 0)
+         return;
+
+      if ((mapping != nullptr) || mapped)
+      {
+         glBindBuffer(target, buffer);
+         glUnmapBuffer(target);
+      }
+
+      for (GLsync fence : fences)
+      {
+         if (fence != 0)
+            glDeleteSync(fence);
+      }
+
+      glDeleteBuffers(1, &buffer);
+
+      buffer = 0;
+      mapping = nullptr;
+      mapped = false;
+      fences.clear();
+      region = 0;
+      used = 0;
+   }
+}
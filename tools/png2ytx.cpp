@@ -0,0 +1,127 @@
+/*
+   Converts PNG images into yam texture containers (.ytx)
+
+   usage: png2ytx [--mipmaps] [--linear] [--repeat]
+                  [--compress | --bc1 | --bc3 | --bc4] image.png...
+
+   Every image.png is written next to itself as image.ytx, flipped for GL
+   and with its mip chain when --mipmaps is given.  --linear and --repeat
+   set the filtering and wrapping the texture gets created with.
+
+   --bc1, --bc3 and --bc4 block compress every image with that format.
+   --compress picks one per image: BC4 for grey images, BC1 for RGB and
+   for RGBA without any transparency, BC3 for the rest.  Grey images with
+   alpha have no matching format and stay uncompressed.
+
+   build: ninja png2ytx
+*/
+
+#include "../include/image/png.hpp"
+#include "../include/image/ytx.hpp"
+
+namespace yam
+{
+   OutputTarget log;
+}
+
+static const uint32_t COMPRESS_AUTO = 1;
+
+static uint32_t pick_compression(const yam::image_t& image)
+{
+   switch (image.channels)
+   {
+      case 1: return yam::TEXTURE_BC4;
+      case 3: return yam::TEXTURE_BC1;
+      case 4:
+      {
+         for (size_t i = 3; i < image.image.size(); i += 4)
+         {
+            if (image.image[i] != 255)
+               return yam::TEXTURE_BC3;
+         }
+
+         return yam::TEXTURE_BC1;
+      }
+   }
+
+   return 0;
+}
+
+static const char* compression_name(uint32_t compression)
+{
+   switch (compression)
+   {
+      case yam::TEXTURE_BC1: return "BC1";
+      case yam::TEXTURE_BC3: return "BC3";
+      case yam::TEXTURE_BC4: return "BC4";
+   }
+
+   return "uncompressed";
+}
+
+int main(int argc, char* argv[])
+{
+   yam::log.set_priority(yam::WARNING);
+
+   yam::texture_params_t params;
+   uint32_t compression = 0;
+   std::vector<std::string> files;
+
+   for (int i = 1; i < argc; ++i)
+   {
+      const std::string arg = argv[i];
+
+      if (arg == "--mipmaps")
+         params.mipmaps = yam::TEXTURE_MIPMAPS_CPU;
+      else if (arg == "--linear")
+         params.filter = yam::TEXTURE_FILTER_LINEAR;
+      else if (arg == "--repeat")
+         params.wrap = GL_REPEAT;
+      else if (arg == "--compress")
+         compression = COMPRESS_AUTO;
+      else if (arg == "--bc1")
+         compression = yam::TEXTURE_BC1;
+      else if (arg == "--bc3")
+         compression = yam::TEXTURE_BC3;
+      else if (arg == "--bc4")
+         compression = yam::TEXTURE_BC4;
+      else
+         files.push_back(arg);
+   }
+
+   if (files.empty())
+   {
+      printf("usage: %s [--mipmaps] [--linear] [--repeat] [--compress | --bc1 | --bc3 | --bc4] image.png...\n",
+             argv[0]);
+      return 1;
+   }
+
+   int failed = 0;
+
+   for (const std::string& file : files)
+   {
+      const size_t dot = file.rfind('.');
+      const std::string output = file.substr(0, (dot == std::string::npos) ? file.size() : dot) + ".ytx";
+
+      yam::image_t image;
+
+      uint32_t result = yam::load_to_buffer<yam::format::PNG>(image, file.c_str());
+
+      const uint32_t format = (compression == COMPRESS_AUTO) ? pick_compression(image) : compression;
+
+      if (result == WHEEL_OK)
+         result = yam::save_ytx(output.c_str(), image, params, format);
+
+      if (result != WHEEL_OK)
+      {
+         printf("%s: conversion failed\n", file.c_str());
+         failed++;
+         continue;
+      }
+
+      printf("%s -> %s   %ux%u, %u channels, %s\n", file.c_str(), output.c_str(),
+             image.width, image.height, image.channels, compression_name(format));
+   }
+
+   return (failed == 0) ? 0 : 1;
+}
@@ -20,6 +20,35 @@ namespace yam
          return std::tie(cursor_pos, cursor_row);
       }
 
+      static inline void set_colour(vertex_t& v, uint32_t c)
+      {
+         v.r = (c & 0xff000000) >> 24;
+         v.g = (c & 0xff0000) >> 16;
+         v.b = (c & 0xff00) >> 8;
+         v.a = c & 0xff;
+      }
+
+      static inline void set_vertex(vertex_t& v, float x, float y, uint16_t s, uint16_t t, uint32_t c)
+      {
+         v.x0 = x;
+         v.y0 = y;
+         v.s0 = s;
+         v.t0 = t;
+         set_colour(v, c);
+      }
+
+      // The 4 corners of a DRAW_QUADS quad at out, texture coordinates go with the corners
+      static inline void quad(vertex_t* out,
+                              float left, float bottom, float right, float top,
+                              uint16_t s_left, uint16_t t_bottom, uint16_t s_right, uint16_t t_top,
+                              uint32_t c)
+      {
+         set_vertex(out[0], left, bottom, s_left, t_bottom, c);
+         set_vertex(out[1], right, bottom, s_right, t_bottom, c);
+         set_vertex(out[2], right, top, s_right, t_top, c);
+         set_vertex(out[3], left, top, s_left, t_top, c);
+      }
+
       void rectangle(uint32_t layer, uint32_t x, uint32_t y,
                      uint32_t w, uint32_t h, uint32_t c,
                      const wcl::string& sprite, float scale)
@@ -27,43 +56,10 @@ namespace yam
          const float x_unit = 2.0f / (float)renderer.GetTargetWidth() * scale;
          const float y_unit = 2.0f / (float)renderer.GetTargetHeight() * scale;
 
-         vertex_t v0, v1, v2, v3;
-
-         float tx_left = .0f;
-         float tx_right = 1.0f;
-         float tx_top = 1.0f;
-         float tx_bottom = 0.0f;
-
-         v0.s0 = 0xffff * tx_left;
-         v0.t0 = 0xffff * tx_bottom;
-
-         v1.s0 = 0xffff * tx_right;
-         v1.t0 = 0xffff * tx_bottom;
-
-         v2.s0 = 0xffff * tx_right;
-         v2.t0 = 0xffff * tx_top;
-
-         v3.s0 = 0xffff * tx_left;
-         v3.t0 = 0xffff * tx_top;
-
-         v0.x0 = -1.0f + (float)x * x_unit;
-         v0.y0 = -1.0f + (float)y * y_unit;
-
-         v1.x0 = -1.0f + (float)(x+w) * x_unit;
-         v1.y0 = v0.y0;
-
-         v2.x0 = v1.x0;
-         v2.y0 = -1.0f + (float)(y+h) * y_unit;
-
-         v3.x0 = v0.x0;
-         v3.y0 = v2.y0;
-
-         v1.r = v2.r = v3.r = v0.r = (c & 0xff000000) >> 24;
-         v1.g = v2.g = v3.g = v0.g = (c & 0xff0000) >> 16;
-         v1.b = v2.b = v3.b = v0.b = (c & 0xff00) >> 8;
-         v1.a = v2.a = v3.a = v0.a = c & 0xff;
-
-         renderer.AddVertices(layer, v0, v1, v3, v1, v2, v3);
+         quad(renderer.ReserveQuads(1, layer),
+              -1.0f + (float)x * x_unit, -1.0f + (float)y * y_unit,
+              -1.0f + (float)(x+w) * x_unit, -1.0f + (float)(y+h) * y_unit,
+              0, 0, 0xffff, 0xffff, c);
       }
 
       void triangle(uint32_t layer,
@@ -76,23 +72,11 @@ namespace yam
          const float x_unit = 2.0f / (float)renderer.GetTargetWidth();
          const float y_unit = 2.0f / (float)renderer.GetTargetHeight();
 
-         vertex_t v0, v1, v2;
-
-         v0.x0 = -1.0f + (float)x0 * x_unit;
-         v0.y0 = -1.0f + (float)y0 * y_unit;
-
-         v1.x0 = -1.0f + (float)x1 * x_unit;
-         v1.y0 = -1.0f + (float)y1 * y_unit;
+         vertex_t* v = renderer.ReserveVertices(3, layer);
 
-         v2.x0 = -1.0f + (float)x2 * x_unit;
-         v2.y0 = -1.0f + (float)y2 * y_unit;
-
-         v1.r = v2.r = v0.r = (c & 0xff000000) >> 24;
-         v1.g = v2.g = v0.g = (c & 0xff0000) >> 16;
-         v1.b = v2.b = v0.b = (c & 0xff00) >> 8;
-         v1.a = v2.a = v0.a = c & 0xff;
-
-         renderer.AddVertices(layer, v0, v1, v2);
+         set_vertex(v[0], -1.0f + (float)x0 * x_unit, -1.0f + (float)y0 * y_unit, 0, 0, c);
+         set_vertex(v[1], -1.0f + (float)x1 * x_unit, -1.0f + (float)y1 * y_unit, 0, 0, c);
+         set_vertex(v[2], -1.0f + (float)x2 * x_unit, -1.0f + (float)y2 * y_unit, 0, 0, c);
       }
 
       void line(uint32_t layer,
@@ -104,21 +88,10 @@ namespace yam
          const float x_unit = 2.0f / (float)renderer.GetTargetWidth();
          const float y_unit = 2.0f / (float)renderer.GetTargetHeight();
 
-         vertex_t v0, v1;
-
-         v0.x0 = -1.0f + (float)x0 * x_unit;
-         v0.y0 = -1.0f + (float)y0 * y_unit;
-
-         v1.x0 = -1.0f + (float)x1 * x_unit;
-         v1.y0 = -1.0f + (float)y1 * y_unit;
+         vertex_t* v = renderer.ReserveVertices(2, layer, GL_LINES);
 
-         v1.r = v0.r = (c & 0xff000000) >> 24;
-         v1.g = v0.g = (c & 0xff0000) >> 16;
-         v1.b = v0.b = (c & 0xff00) >> 8;
-         v1.a = v0.a = c & 0xff;
-
-         renderer.AddVertex(v0, layer, GL_LINES);
-         renderer.AddVertex(v1, layer, GL_LINES);
+         set_vertex(v[0], -1.0f + (float)x0 * x_unit, -1.0f + (float)y0 * y_unit, 0, 0, c);
+         set_vertex(v[1], -1.0f + (float)x1 * x_unit, -1.0f + (float)y1 * y_unit, 0, 0, c);
       }
 
       void text(uint32_t layer,
@@ -126,9 +99,13 @@ namespace yam
                 const wcl::string& text,
                 uint32_t colour)
       {
-         wcl::string old_shader = renderer.GetShader();
+         // Looked up once, drawing text doesn't touch any names
+         static const shader_handle_t text_shader = renderer.ShaderHandle("builtin_text");
+         static const atlas_handle_t font_atlas = renderer.AtlasHandle(YAM_FONTBUFFER_NAME);
+
+         const shader_handle_t old_shader = renderer.CurrentShader();
 
-         renderer.SetShader("builtin_text");
+         renderer.SetShader(text_shader);
 
          wheel::rect_t r;
 
@@ -141,7 +118,6 @@ namespace yam
          float leftv, rightv, bottomv, topv;
 
          char32_t c;
-         vertex_t v0, v1, v2, v3;
 
          for (size_t i = 0; i < text.length(); ++i)
          {
@@ -164,9 +140,9 @@ namespace yam
                continue;
             }
 
-            if (renderer.GetAtlasPos(YAM_FONTBUFFER_NAME, font.prefix + c, &r) != WHEEL_OK)
+            if (renderer.GetAtlasPos(font_atlas, font.glyph_sprite(c), &r) != WHEEL_OK)
             {
-               if (!font.atlas_glyph(c))
+               if (!font.atlas_glyph(c) || (renderer.GetAtlasPos(font_atlas, font.glyph_sprite(c), &r) != WHEEL_OK))
                   continue;
             }
 
@@ -180,43 +156,14 @@ namespace yam
             bottomv  = -1.0f + y_unit * (cursor_row);
             topv     = -1.0f + y_unit * (cursor_row + font.glyph_height(c));
 
-            v0.r = (colour & 0xff000000) >> 24;
-            v0.g = (colour & 0xff0000) >> 16;
-            v0.b = (colour & 0xff00) >> 8;
-            v0.a = (colour & 0xff);
-
-            v0.s0 = left;
-            v0.t0 = bottom;
-            v0.x0 = leftv;
-            v0.y0 = bottomv;
-
-            v1.s0 = right;
-            v1.t0 = bottom;
-            v1.x0 = rightv;
-            v1.y0 = v0.y0;
-
-            v2.s0 = right;
-            v2.t0 = top;
-            v2.x0 = v1.x0;
-            v2.y0 = topv;
-
-            v3.s0 = left;
-            v3.t0 = top;
-            v3.x0 = v0.x0;
-            v3.y0 = v2.y0;
-
-            v3.r = v2.r = v1.r = v0.r;
-            v3.g = v2.g = v1.g = v0.g;
-            v3.b = v2.b = v1.b = v0.b;
-            v3.a = v2.a = v1.a = v0.a;
-
-            renderer.AddVertices(layer, v0, v1, v3, v1, v2, v3);
+            quad(renderer.ReserveQuads(1, layer), leftv, bottomv, rightv, topv,
+                 left, bottom, right, top, colour);
 
             cursor_pos += font.get_advance(c);
             cursor_row += font.get_advance_vertical(c);
          }
 
-         if (old_shader != renderer.GetShader())
+         if (old_shader != renderer.CurrentShader())
             renderer.SetShader(old_shader);
       }
    }
@@ -0,0 +1,91 @@
+#include "include/vertex_format.h"
+
+namespace yam
+{
+   GLuint VertexFormat::vao_in_use = 0;
+
+   void VertexFormat::Create()
+   {
+      glGenVertexArrays(1, &vao);
+      glBindVertexArray(vao);
+      vao_in_use = vao;
+
+      const bool binding_points = GLEW_VERSION_4_3 || GLEW_ARB_vertex_attrib_binding;
+
+      for (const vertex_attribute_t& attribute : attributes)
+      {
+         glEnableVertexAttribArray(attribute.location);
+
+         if (binding_points)
+         {
+            glVertexAttribFormat(attribute.location, attribute.size, attribute.type,
+                                 attribute.normalized, attribute.offset);
+            glVertexAttribBinding(attribute.location, 0);
+         } else {
+            glVertexAttribDivisor(attribute.location, divisor);
+         }
+      }
+
+      if (binding_points)
+         glVertexBindingDivisor(0, divisor);
+
+      buffer = 0;
+   }
+
+   void VertexFormat::Bind(GLuint new_buffer, size_t new_offset)
+   {
+      if (vao == 0)
+         Create();
+
+      if (vao_in_use != vao)
+      {
+         glBindVertexArray(vao);
+         vao_in_use = vao;
+      }
+
+      if ((buffer == new_buffer) && (offset == new_offset))
+         return;
+
+      buffer = new_buffer;
+      offset = new_offset;
+
+      if (GLEW_VERSION_4_3 || GLEW_ARB_vertex_attrib_binding)
+      {
+         glBindVertexBuffer(0, buffer, offset, stride);
+         return;
+      }
+
+      glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+      for (const vertex_attribute_t& attribute : attributes)
+      {
+         glVertexAttribPointer(attribute.location, attribute.size, attribute.type,
+                               attribute.normalized, stride,
+                               (void*)(offset + attribute.offset)
+                              );
+      }
+   }
+
+   void VertexFormat::Unbind()
+   {
+      if (vao_in_use == 0)
+         return;
+
+      glBindVertexArray(0);
+      vao_in_use = 0;
+   }
+
+   void VertexFormat::Destroy()
+   {
+      if (vao == 0)
+         return;
+
+      if (vao_in_use == vao)
+         Unbind();
+
+      glDeleteVertexArrays(1, &vao);
+
+      vao = 0;
+      buffer = 0;
+   }
+}